@@ -20,16 +20,23 @@ typedef int ssize_t;
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 #define closesocket close
 
 #endif
 
 #include "Connection.hpp"
+#include "MessageView.hpp"
 
 //------------------------------------------------------
 
@@ -38,6 +45,13 @@ typedef int ssize_t;
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
 
 //NOTE: much of the sockets code herein is based on http-tweak's single-header http server
 // see: https://github.com/ixchow/http-tweak
@@ -45,21 +59,408 @@ typedef int ssize_t;
 //Also, some help and examples for getaddrinfo from: https://beej.us/guide/bgnet/html/multi/syscalls.html
 
 
+static void udp_close(Connection &c);
+
 void Connection::close() {
+	if (udp) {
+		//(UDP connections share the server's socket, so this tells the peer and forgets it instead)
+		if (socket != InvalidSocket) udp_close(*this);
+		return;
+	}
 	if (socket != InvalidSocket) {
 		::closesocket(socket);
 		socket = InvalidSocket;
+		if (pending) pending->closed = true;
 	}
 }
 
 //---------------------------------
-//Polling helper used by both server and client:
+//Impairment (see Connection.hpp):
+
+Impairment Impairment::parse(std::string const &spec) {
+	Impairment impairment;
+	size_t begin = 0;
+	while (begin < spec.size()) {
+		size_t end = spec.find(',', begin);
+		if (end == std::string::npos) end = spec.size();
+		std::string setting = spec.substr(begin, end - begin);
+		begin = end + 1;
+		if (setting.empty()) continue;
+
+		size_t equals = setting.find('=');
+		if (equals == std::string::npos) throw std::runtime_error("Impairment setting '" + setting + "' should look like name=value.");
+		std::string name = setting.substr(0, equals);
+		std::string value = setting.substr(equals + 1);
+
+		double number = 0.0;
+		size_t used = 0;
+		try {
+			number = std::stod(value, &used);
+		} catch (std::exception &) {
+			throw std::runtime_error("Impairment setting '" + setting + "' has a malformed value.");
+		}
+		std::string suffix = value.substr(used);
+		if (suffix == "ms") number *= 1e-3;
+		else if (suffix == "k") number *= 1e3;
+		else if (suffix == "M") number *= 1e6;
+		else if (suffix == "%") number *= 1e-2;
+		else if (suffix != "" && suffix != "s") throw std::runtime_error("Impairment setting '" + setting + "' has unknown suffix '" + suffix + "'.");
+		if (!(number >= 0.0)) throw std::runtime_error("Impairment setting '" + setting + "' should not be negative.");
+
+		if (name == "seed") {
+			impairment.seed = uint32_t(number);
+			continue;
+		}
+
+		std::vector< Direction * > directions{ &impairment.send, &impairment.recv };
+		if (name.compare(0, 5, "send.") == 0) {
+			directions = { &impairment.send };
+			name = name.substr(5);
+		} else if (name.compare(0, 5, "recv.") == 0) {
+			directions = { &impairment.recv };
+			name = name.substr(5);
+		}
+		for (Direction *direction : directions) {
+			if (name == "latency") direction->latency = number;
+			else if (name == "jitter") direction->jitter = number;
+			else if (name == "bandwidth") direction->bandwidth = number;
+			else if (name == "loss") direction->loss = number;
+			else if (name == "reorder") direction->reorder = number;
+			else throw std::runtime_error("Impairment setting '" + setting + "' has unknown name.");
+		}
+	}
+	return impairment;
+}
+
+Impairment Impairment::from_env() {
+	char const *spec = std::getenv("NET_IMPAIR");
+	if (spec == nullptr) return Impairment();
+	return parse(spec);
+}
+
+static constexpr size_t ImpairPacketSize = 1400; //bytes; (TCP) streams are cut into packets of at most this size
+static constexpr double ImpairRetransmitTime = 0.2; //seconds a lost (TCP) packet is held up, like a minimum retransmit timeout
+static constexpr double ImpairStreamQueueTime = 0.05; //seconds of (TCP) backlog taken onto a link, like a socket buffer; the rest waits in send_buffer
+static constexpr double ImpairMaxQueueTime = 0.5; //seconds of (UDP) backlog a link holds before dropping datagrams, like a router's queue
+
+static double seconds_now() {
+	return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//settings and random numbers shared by all of a Server's or Client's links:
+struct Impairer {
+	explicit Impairer(Impairment const &impairment_) : impairment(impairment_), mt(impairment_.seed) { }
+
+	//pick up changes to the owner's settings:
+	void update(Impairment const &impairment_) {
+		if (impairment_.seed != impairment.seed) mt.seed(impairment_.seed);
+		impairment = impairment_;
+	}
+
+	double random() { return std::uniform_real_distribution< double >(0.0, 1.0)(mt); }
+
+	Impairment impairment;
+	std::mt19937 mt;
+};
+
+//one direction of a simulated link:
+struct ImpairQueue {
+	struct Packet {
+		double when; //time the packet comes out of the link
+		std::string to; //(UDP) peer address
+		std::vector< uint8_t > bytes;
+	};
+	std::deque< Packet > packets; //ordered by 'when'
+	double link_free = 0.0; //time the link finishes sending what has been admitted (at 'bandwidth')
+	double last_in_order = 0.0; //'when' of the latest in-order packet, which later packets may not overtake
+
+	//put a packet on the link:
+	// 'stream' packets are never dropped or reordered (loss holds them up instead).
+	// returns 'false' if the packet was dropped
+	bool admit(Impairer &impairer, Impairment::Direction const &d, double now, std::string const &to, uint8_t const *data, size_t size, bool stream) {
+		double depart = now;
+		if (d.bandwidth > 0.0) {
+			depart = std::max(now, link_free) + double(size) / d.bandwidth;
+			if (!stream && depart - now > ImpairMaxQueueTime) return false; //queue is full
+			link_free = depart;
+		}
+		double when = depart + d.latency;
+		if (d.jitter > 0.0) when += d.jitter * impairer.random();
+		if (d.loss > 0.0 && impairer.random() < d.loss) {
+			if (!stream) return false;
+			when += ImpairRetransmitTime;
+		}
+		if (!stream && d.reorder > 0.0 && impairer.random() < d.reorder) {
+			when = depart; //goes straight through, ahead of anything being held
+		} else {
+			when = std::max(when, last_in_order);
+			last_in_order = when;
+		}
+		auto at = std::upper_bound(packets.begin(), packets.end(), when, [](double w, Packet const &p) { return w < p.when; });
+		packets.insert(at, Packet{ when, to, std::vector< uint8_t >(data, data + size) });
+		return true;
+	}
+
+	//call 'f(Packet &)' on each packet that has come out of the link by 'now', in order:
+	template< typename F >
+	void release(double now, F const &f) {
+		while (!packets.empty() && packets.front().when <= now) {
+			f(packets.front());
+			packets.pop_front();
+		}
+	}
+
+	double next_release() const {
+		return packets.empty() ? std::numeric_limits< double >::infinity() : packets.front().when;
+	}
+};
+
+//both directions of a simulated link:
+struct ImpairedLink {
+	explicit ImpairedLink(Impairer *impairer_) : impairer(impairer_) { }
+	Impairer *impairer; //(owned by the Server or Client)
+	ImpairQueue send;
+	ImpairQueue recv;
+	Connection::Buffer ready; //(TCP) bytes that have come out of 'send' but that the socket hasn't taken yet
+};
+
+//(TCP) next time a connection's impaired traffic needs attention:
+static double impaired_wake_time(Connection const &c) {
+	ImpairedLink const &link = *c.impaired;
+	double wake = std::min(link.send.next_release(), link.recv.next_release());
+	if (!c.send_buffer.empty()) wake = std::min(wake, link.send.link_free - ImpairStreamQueueTime);
+	return wake;
+}
+
+//(TCP) pass received bytes through a connection's simulated link:
+static void impaired_recv(Connection &c, uint8_t const *data, size_t size, double now) {
+	ImpairedLink &link = *c.impaired;
+	for (size_t at = 0; at < size; at += ImpairPacketSize) {
+		link.recv.admit(*link.impairer, link.impairer->impairment.recv, now, std::string(), data + at, std::min(ImpairPacketSize, size - at), true);
+	}
+}
+
+//(TCP) hand over received bytes that have come out of a connection's simulated link:
+static void impaired_deliver(
+	Connection &c,
+	double now,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	bool any = false;
+	c.impaired->recv.release(now, [&](ImpairQueue::Packet &packet) {
+		c.recv_buffer.append(packet.bytes.data(), packet.bytes.size());
+		any = true;
+	});
+	if (any && on_event) on_event(&c, Connection::OnRecv);
+}
+
+//---------------------------------
+//Per-socket helpers shared by the polling backends:
+
+//accept one pending connection from listen_socket:
+// returns 'false' if there was nothing to accept
+static bool accept_connection(
+	char const *where,
+	Socket listen_socket,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	Socket got = accept(listen_socket, NULL, NULL);
+	if (got == InvalidSocket) {
+		//oh well.
+		return false;
+	}
+	#ifdef _WIN32
+	unsigned long one = 1;
+	if (0 == ioctlsocket(got, FIONBIO, &one)) {
+	#else
+	{
+	#endif
+		connections.emplace_back();
+		connections.back().socket = got;
+		std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
+		if (on_event) on_event(&connections.back(), Connection::OnOpen);
+	}
+	return true;
+}
+
+//read everything currently available on a connection's socket into its recv_buffer:
+static void recv_connection(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	const uint32_t BufferSize = 20000;
+	static thread_local char *buffer = new char[BufferSize];
+
+	while (true) { //read until more data left to read
+		ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~ but no data
+			break;
+		} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
+			//~problem~ so remove connection
+			//(anything still held back by impairment arrives first)
+			if (c.impaired) impaired_deliver(c, std::numeric_limits< double >::infinity(), on_event);
+			if (c.socket == InvalidSocket) break; //(closed while handling it)
+			if (ret == 0) {
+				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+			} else if (ret < 0) {
+				std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+			} else {
+				std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			break;
+		} else { //ret > 0
+			if (c.impaired) {
+				impaired_recv(c, reinterpret_cast< uint8_t const * >(buffer), size_t(ret), seconds_now());
+			} else {
+				c.recv_buffer.append(buffer, size_t(ret));
+				if (on_event) on_event(&c, Connection::OnRecv);
+			}
+			if (ret < BufferSize) break; //ran out of data before buffer: no more data left to read
+		}
+	}
+}
+
+//(TCP) move a connection's send_buffer onto its simulated link (as fast as the link's bandwidth allows),
+// then send whatever has come out of the link, as far as the socket will take it:
+// returns 'false' if the socket would block
+static bool send_connection_impaired(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	ImpairedLink &link = *c.impaired;
+	Impairment::Direction const &direction = link.impairer->impairment.send;
+	double now = seconds_now();
+
+	while (!c.send_buffer.empty() && (direction.bandwidth <= 0.0 || link.send.link_free <= now + ImpairStreamQueueTime)) {
+		uint8_t packet[ImpairPacketSize];
+		size_t size = 0;
+		c.send_buffer.for_each_piece([&](uint8_t const *data, size_t count) {
+			count = std::min(count, ImpairPacketSize - size);
+			std::memcpy(packet + size, data, count);
+			size += count;
+			return size < ImpairPacketSize;
+		});
+		c.send_buffer.consume(size);
+		link.send.admit(*link.impairer, direction, now, std::string(), packet, size, true);
+	}
+
+	link.send.release(now, [&](ImpairQueue::Packet &packet) {
+		link.ready.append(packet.bytes.data(), packet.bytes.size());
+	});
+
+	while (!link.ready.empty()) {
+		#ifdef _WIN32
+		ssize_t ret = ::send(c.socket, reinterpret_cast< char const * >(link.ready.data()), int(link.ready.size()), 0);
+		if (ret < 0 && WSAGetLastError() == WSAEWOULDBLOCK) errno = EWOULDBLOCK;
+		#else
+		ssize_t ret = ::send(c.socket, link.ready.data(), link.ready.size(), MSG_DONTWAIT);
+		#endif
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return false;
+		} else if (ret <= 0) {
+			std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			break;
+		}
+		link.ready.consume(size_t(ret));
+	}
+	return true;
+}
+
+//send as much of a connection's send_buffer as its socket will take:
+// (gathers up to MaxPieces of the queue's segments into each sendmsg() / WSASend() call, so nothing is copied)
+// returns 'false' if the socket would block (so the caller should wait to be told it is writable again)
+static bool send_connection(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	if (c.impaired) return send_connection_impaired(where, c, on_event);
+
+	constexpr uint32_t MaxPieces = 64;
+
+	while (!c.send_buffer.empty()) {
+		#ifdef _WIN32
+		WSABUF pieces[MaxPieces];
+		#else
+		struct iovec pieces[MaxPieces];
+		#endif
+		uint32_t count = 0;
+		size_t total = 0;
+		c.send_buffer.for_each_piece([&](uint8_t const *data, size_t size) {
+			#ifdef _WIN32
+			pieces[count].buf = reinterpret_cast< char * >(const_cast< uint8_t * >(data));
+			pieces[count].len = ULONG(size);
+			#else
+			pieces[count].iov_base = const_cast< uint8_t * >(data);
+			pieces[count].iov_len = size;
+			#endif
+			total += size;
+			count += 1;
+			return count < MaxPieces;
+		});
+
+		#ifdef _WIN32
+		DWORD sent = 0;
+		ssize_t ret = (WSASend(c.socket, pieces, DWORD(count), &sent, 0, NULL, NULL) == 0 ? ssize_t(sent) : -1);
+		if (ret < 0 && WSAGetLastError() == WSAEWOULDBLOCK) errno = EWOULDBLOCK;
+		#else
+		struct msghdr msg;
+		std::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = pieces;
+		msg.msg_iovlen = count;
+		ssize_t ret = sendmsg(c.socket, &msg, MSG_DONTWAIT);
+		#endif
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~, but don't keep trying
+			return false;
+		} else if (ret <= 0 || ret > (ssize_t)total) {
+			if (ret < 0) {
+				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+			} else { assert(ret == 0 || ret > (ssize_t)total);
+				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << total << "], disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			break;
+		} else { //ret seems reasonable
+			c.send_buffer.consume(size_t(ret));
+			if (size_t(ret) < total) break; //socket took less than offered; it's probably full
+		}
+	}
+	return true;
+}
+
+//close a connection whose send_buffer has grown past its limit:
+static void check_send_limit(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	if (c.socket == InvalidSocket || c.send_limit == 0 || c.send_buffer.size() <= c.send_limit) return;
+
+	std::cerr << "[" << where << "] " << c.send_buffer.size() << " bytes waiting to send (limit is " << c.send_limit << "), disconnecting." << std::endl;
+	c.close();
+	if (on_event) on_event(&c, Connection::OnClose);
+}
+
+//---------------------------------
+//select()-based polling helper used by both server and client:
+// (rebuilds the fd_sets from every connection on each call; limited to FD_SETSIZE sockets)
 void poll_connections(
 	char const *where,
 	std::list< Connection > &connections,
 	std::function< void(Connection *, Connection::Event event) > const &on_event,
 	double timeout,
-	Socket listen_socket = InvalidSocket) {
+	Socket listen_socket = InvalidSocket,
+	Impairer *impairer = nullptr) {
 
 	fd_set read_fds, write_fds;
 	FD_ZERO(&read_fds);
@@ -74,11 +475,16 @@ void poll_connections(
 	}
 
 	//add each connection's socket to read (and possibly write) sets:
-	for (auto c : connections) {
+	double now = (impairer ? seconds_now() : 0.0);
+	for (auto const &c : connections) {
 		if (c.socket != InvalidSocket) {
 			max = std::max(max, int(c.socket));
 			FD_SET(c.socket, &read_fds);
-			if (!c.send_buffer.empty()) {
+			if (c.impaired) {
+				//(wake up when held-back traffic is due)
+				if (!c.impaired->ready.empty()) FD_SET(c.socket, &write_fds);
+				timeout = std::max(0.0, std::min(timeout, impaired_wake_time(c) - now));
+			} else if (!c.send_buffer.empty()) {
 				FD_SET(c.socket, &write_fds);
 			}
 		}
@@ -93,7 +499,7 @@ void poll_connections(
 
 		if (ret < 0) {
 			std::cerr << "[" << where << "] Select returned an error; will attempt to read/write anyway." << std::endl;
-		} else if (ret == 0) {
+		} else if (ret == 0 && impairer == nullptr) {
 			//nothing to read or write.
 			return;
 		}
@@ -101,90 +507,532 @@ void poll_connections(
 
 	//add new connections as needed:
 	if (listen_socket != InvalidSocket && FD_ISSET(listen_socket, &read_fds)) {
-		Socket got = accept(listen_socket, NULL, NULL);
-		if (got == InvalidSocket) {
-			//oh well.
-		} else {
-			#ifdef _WIN32
-			unsigned long one = 1;
-			if (0 == ioctlsocket(got, FIONBIO, &one)) {
-			#else
-			{
-			#endif
-				connections.emplace_back();
-				connections.back().socket = got;
-				std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
-				if (on_event) on_event(&connections.back(), Connection::OnOpen);
-			}
-		}
+		accept_connection(where, listen_socket, connections, on_event);
 	}
 
-	const uint32_t BufferSize = 20000;
-	static thread_local char *buffer = new char[BufferSize];
-
 	//process requests:
 	for (auto &c : connections) {
 		//only read from valid sockets marked readable:
 		if (c.socket == InvalidSocket || !FD_ISSET(c.socket, &read_fds)) continue;
 
-		while (true) { //read until more data left to read
-			ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
-			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-				//~no problem~ but no data
-				break;
-			} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
-				//~problem~ so remove connection
-				if (ret == 0) {
-					std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
-				} else if (ret < 0) {
-					std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
-				} else {
-					std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
-				}
-				c.close();
-				if (on_event) on_event(&c, Connection::OnClose);
-				break;
-			} else { //ret > 0
-				c.recv_buffer.insert(c.recv_buffer.end(), buffer, buffer + ret);
-				if (on_event) on_event(&c, Connection::OnRecv);
-				if (ret < BufferSize) break; //ran out of data before buffer: no more data left to read
-			}
+		recv_connection(where, c, on_event);
+	}
+
+	//hand over impaired traffic that has arrived:
+	if (impairer) {
+		now = seconds_now();
+		for (auto &c : connections) {
+			if (c.socket != InvalidSocket && c.impaired) impaired_deliver(c, now, on_event);
 		}
 	}
 
 	//process responses:
 	for (auto &c : connections) {
 		//don't bother with connections unless they are valid, have something to send, and are marked writable:
-		if (c.socket == InvalidSocket || c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds)) continue;
-		
+		// (impaired connections are always checked, since their traffic is released on a schedule)
+		if (c.socket == InvalidSocket) continue;
+		if (!c.impaired && (c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds))) continue;
+
+		send_connection(where, c, on_event);
+	}
+
+	for (auto &c : connections) {
+		check_send_limit(where, c, on_event);
+	}
+}
+
+#ifdef __linux__
+//---------------------------------
+//epoll()-based polling helper used by the server:
+// sockets are registered (edge-triggered) once, when they are accepted, so each call only touches the sockets
+// the kernel reports events for, plus those listed in 'pending' as having queued output (see Connection::queued).
+// (impaired connections are the exception: they are all visited, since their traffic is released on a schedule)
+void poll_connections_epoll(
+	char const *where,
+	Socket epoll_fd,
+	std::list< Connection > &connections,
+	Connection::Pending &pending,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket,
+	Impairer *impairer) {
+
+	//try to flush queued output before waiting, so a poll with a timeout doesn't sit on fresh data:
+	// (sockets that have reported EAGAIN are skipped until their next EPOLLOUT edge)
+	// connections stay listed until their output is gone (or they close), and are checked against their send limit here,
+	// since that's the only time their send_buffer can have grown:
+	auto flush = [&]() {
+		for (size_t p = 0; p < pending.output.size(); /* later */) {
+			Connection &c = *pending.output[p];
+			if (c.socket != InvalidSocket && (!c.send_buffer.empty() || c.impaired) && c.writable) {
+				c.writable = send_connection(where, c, on_event);
+			}
+			check_send_limit(where, c, on_event);
+			if (c.socket != InvalidSocket && (!c.send_buffer.empty() || c.impaired)) {
+				++p;
+			} else {
+				c.listed = false;
+				pending.output[p] = pending.output.back();
+				pending.output.pop_back();
+			}
+		}
+	};
+	flush();
+
+	constexpr int MaxEvents = 256;
+	static thread_local struct epoll_event events[MaxEvents];
+
+	if (impairer) {
+		//wake up when held-back traffic is due:
+		double now = seconds_now();
+		for (auto const &c : connections) {
+			if (c.socket != InvalidSocket && c.impaired) timeout = std::max(0.0, std::min(timeout, impaired_wake_time(c) - now));
+		}
+	}
+
+	//wait (until timeout) for sockets' data to become available:
+	// (epoll_wait takes milliseconds; round up so that short timeouts don't turn into busy-waiting)
+	int timeout_ms = (timeout <= 0.0 ? 0 : int(std::ceil(timeout * 1e3)));
+	int count = epoll_wait(epoll_fd, events, MaxEvents, timeout_ms);
+	if (count < 0) {
+		if (errno != EINTR) {
+			std::cerr << "[" << where << "] epoll_wait returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
+		}
+		return;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		Connection *c = reinterpret_cast< Connection * >(events[i].data.ptr);
+
+		if (c == nullptr) {
+			//listen socket: edge-triggered, so accept everything that is pending:
+			while (accept_connection(where, listen_socket, connections, on_event)) {
+				Connection &added = connections.back();
+				if (added.socket == InvalidSocket) { //closed by OnOpen handler
+					pending.closed = true;
+					continue;
+				}
+				added.pending = &pending;
+				if (!added.send_buffer.empty() || added.impaired) added.queued();
+
+				struct epoll_event evt;
+				evt.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+				evt.data.ptr = &added;
+				if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, added.socket, &evt) != 0) {
+					std::cerr << "[" << where << "] failed to add connection to epoll set (" << strerror(errno) << "), disconnecting." << std::endl;
+					added.close();
+					if (on_event) on_event(&added, Connection::OnClose);
+				}
+			}
+			continue;
+		}
+
+		//connection may have been closed by an earlier event's handler:
+		if (c->socket == InvalidSocket) continue;
+
+		if (events[i].events & EPOLLOUT) {
+			c->writable = true;
+			if (!c->send_buffer.empty() || c->impaired) c->queued();
+		}
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			recv_connection(where, *c, on_event);
+		}
+	}
+
+	//hand over impaired traffic that has arrived:
+	if (impairer) {
+		double now = seconds_now();
+		for (auto &c : connections) {
+			if (c.socket != InvalidSocket && c.impaired) impaired_deliver(c, now, on_event);
+		}
+	}
+
+	//send anything queued during event handling or unblocked by EPOLLOUT:
+	flush();
+}
+#endif
+
+
+//---------------------------------
+//UDP transport:
+// Every datagram starts with |kind|ack0|ack1|ack2|ack3| where 'ack' (little endian) is the sequence number
+// of the next reliable chunk the sender expects from its peer (so every datagram acknowledges the stream).
+// After that:
+//  UDPConnect    -- (client to server) opens a connection; resent until the server replies
+//  UDPReliable   -- |seq (4)|bytes...| next chunk of the reliable byte stream (go-back-N: out-of-order chunks are dropped and resent)
+//  UDPUnreliable -- |seq (4)|message...| one whole message; dropped if a newer one has already arrived
+//  UDPAck        -- (nothing else) sent when a chunk needs acknowledging or the link has been quiet for a while
+//  UDPDisconnect -- the sender closed the connection
+
+enum UDPKind : uint8_t {
+	UDPConnect = 'C',
+	UDPReliable = 'R',
+	UDPUnreliable = 'U',
+	UDPAck = 'A',
+	UDPDisconnect = 'D',
+};
+
+static constexpr size_t UDPMaxDatagram = 1200; //bytes; small enough to avoid IP fragmentation on most paths
+static constexpr size_t UDPHeaderSize = 1 + 4; //kind, ack
+static constexpr size_t UDPMaxPayload = UDPMaxDatagram - UDPHeaderSize - 4; //(after a seq)
+static constexpr uint32_t UDPWindow = 64; //reliable chunks in flight before the sender waits for acks
+static constexpr double UDPResendTime = 0.2; //seconds before unacknowledged chunks are resent
+static constexpr double UDPConnectTime = 0.25; //seconds between (client) connect attempts
+static constexpr double UDPKeepAliveTime = 0.5; //seconds of not sending before an ack is sent anyway
+static constexpr double UDPTimeout = 5.0; //seconds of not hearing from a peer before giving up on it
+
+static bool udp_would_block() {
+	#ifdef _WIN32
+	int err = WSAGetLastError();
+	//(windows reports ICMP "port unreachable" replies to earlier datagrams as errors on the next read)
+	return err == WSAEWOULDBLOCK || err == WSAECONNRESET;
+	#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED;
+	#endif
+}
+
+//per-socket state:
+struct UDPHost {
+	Socket socket = InvalidSocket;
+	bool is_server = false;
+	std::unordered_map< std::string, Connection * > peers; //(server) open connections, by address
+	std::shared_ptr< ImpairedLink > impaired; //datagrams held back by impairment (to and from every peer); nullptr unless impairment is on
+};
+
+//per-connection state:
+struct UDPLink {
+	UDPHost *host = nullptr;
+	std::string peer; //address (bytes of a sockaddr)
+	bool owns_socket = false; //(client) closing the connection closes the socket
+	bool connected = false; //(client) heard from the server
+	bool peer_closed = false; //peer sent a UDPDisconnect
+
+	//reliable stream, outgoing:
+	struct Chunk {
+		uint32_t seq;
+		std::vector< uint8_t > bytes;
+	};
+	std::deque< Chunk > unacked; //sent chunks, oldest first
+	uint32_t next_seq = 1; //seq of the next new chunk
+	double resend_at = 0.0;
+
+	//reliable stream, incoming:
+	uint32_t expected_seq = 1; //seq of the next chunk to accept
+	Connection::Buffer stream; //received bytes not yet framed into whole messages
+	bool ack_needed = false;
+
+	//unreliable messages:
+	uint32_t next_unreliable_seq = 1; //(outgoing)
+	uint32_t newest_unreliable_seq = 0; //(incoming)
+
+	double connect_at = 0.0; //(client) time of the next connect attempt
+	double last_sent = 0.0;
+	double last_recv = 0.0;
+};
+
+static std::string udp_address(struct sockaddr const *addr, size_t len) {
+	return std::string(reinterpret_cast< char const * >(addr), len);
+}
+
+//send a datagram right away:
+// (errors -- e.g., a full socket buffer -- are treated like packet loss)
+static void udp_sendto(Socket socket, std::string const &to, uint8_t const *data, size_t size) {
+	struct sockaddr_storage addr;
+	assert(to.size() <= sizeof(addr));
+	std::memcpy(&addr, to.data(), to.size());
+	#ifdef _WIN32
+	sendto(socket, reinterpret_cast< char const * >(data), int(size), 0, reinterpret_cast< struct sockaddr const * >(&addr), int(to.size()));
+	#else
+	sendto(socket, data, size, 0, reinterpret_cast< struct sockaddr const * >(&addr), socklen_t(to.size()));
+	#endif
+}
+
+//send a datagram to a link's peer, subject to the host's impairment:
+static void udp_send(UDPLink &link, UDPKind kind, uint32_t const *seq, uint8_t const *payload, size_t payload_size, double now) {
+	std::vector< uint8_t > datagram;
+	datagram.reserve(UDPHeaderSize + 4 + payload_size);
+	datagram.emplace_back(uint8_t(kind));
+	for (uint32_t i = 0; i < 4; ++i) datagram.emplace_back(uint8_t(link.expected_seq >> (8 * i)));
+	if (seq) {
+		for (uint32_t i = 0; i < 4; ++i) datagram.emplace_back(uint8_t(*seq >> (8 * i)));
+	}
+	datagram.insert(datagram.end(), payload, payload + payload_size);
+
+	link.last_sent = now;
+	link.ack_needed = false;
+
+	UDPHost &host = *link.host;
+	if (host.impaired) {
+		ImpairedLink &impaired = *host.impaired;
+		impaired.send.admit(*impaired.impairer, impaired.impairer->impairment.send, now, link.peer, datagram.data(), datagram.size(), false);
+		return;
+	}
+	udp_sendto(host.socket, link.peer, datagram.data(), datagram.size());
+}
+
+static uint32_t udp_read_u32(uint8_t const *data) {
+	return uint32_t(data[0]) | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
+}
+
+static void udp_close(Connection &c) {
+	UDPLink &link = *c.udp;
+	if (!link.peer_closed) {
+		//let the peer know (once, right away, and without impairment -- it's only a courtesy):
+		uint8_t datagram[UDPHeaderSize] = { uint8_t(UDPDisconnect), 0, 0, 0, 0 };
+		udp_sendto(link.host->socket, link.peer, datagram, sizeof(datagram));
+	}
+	if (link.host->is_server) link.host->peers.erase(link.peer);
+	if (link.owns_socket) ::closesocket(c.socket);
+	c.socket = InvalidSocket;
+}
+
+//send what a connection has queued (replaceable segments unreliably, everything else as reliable chunks),
+// plus resends, connect attempts, and acks as needed:
+static void udp_flush(Connection &c, double now) {
+	UDPLink &link = *c.udp;
+
+	if (!link.host->is_server && !link.connected) {
+		if (now < link.connect_at) return;
+		udp_send(link, UDPConnect, nullptr, nullptr, 0, now);
+		link.connect_at = now + UDPConnectTime;
+	}
+
+	//replaceable segments are each sent (once) as an unreliable datagram:
+	std::vector< uint8_t > too_big; //(segments that don't fit in a datagram go in the reliable stream instead)
+	c.send_buffer.take_tagged([&](Connection::SendQueue::Segment const &segment) {
+		std::vector< uint8_t > message(segment.owned);
+		if (segment.shared) message.insert(message.end(), segment.shared->begin(), segment.shared->end());
+		if (message.size() > UDPMaxPayload) {
+			too_big.insert(too_big.end(), message.begin(), message.end());
+			return;
+		}
+		uint32_t seq = link.next_unreliable_seq++;
+		udp_send(link, UDPUnreliable, &seq, message.data(), message.size(), now);
+	});
+	if (!too_big.empty()) c.send_buffer.append(too_big.data(), too_big.size());
+
+	//everything else is cut into reliable chunks, as the window allows:
+	while (!c.send_buffer.empty() && link.unacked.size() < UDPWindow) {
+		link.unacked.emplace_back();
+		UDPLink::Chunk &chunk = link.unacked.back();
+		chunk.seq = link.next_seq++;
+		c.send_buffer.for_each_piece([&](uint8_t const *data, size_t size) {
+			size_t count = std::min(size, UDPMaxPayload - chunk.bytes.size());
+			chunk.bytes.insert(chunk.bytes.end(), data, data + count);
+			return chunk.bytes.size() < UDPMaxPayload;
+		});
+		c.send_buffer.consume(chunk.bytes.size());
+		if (link.unacked.size() == 1) link.resend_at = now + UDPResendTime;
+		udp_send(link, UDPReliable, &chunk.seq, chunk.bytes.data(), chunk.bytes.size(), now);
+	}
+
+	//nothing acknowledged in a while? resend everything in flight:
+	if (!link.unacked.empty() && now >= link.resend_at) {
+		for (auto const &chunk : link.unacked) {
+			udp_send(link, UDPReliable, &chunk.seq, chunk.bytes.data(), chunk.bytes.size(), now);
+		}
+		link.resend_at = now + UDPResendTime;
+	}
+
+	if (link.ack_needed || now - link.last_sent >= UDPKeepAliveTime) {
+		udp_send(link, UDPAck, nullptr, nullptr, 0, now);
+	}
+}
+
+//send datagrams that have come out of the host's simulated link:
+static void udp_send_impaired(UDPHost &host, double now) {
+	if (!host.impaired) return;
+	host.impaired->send.release(now, [&](ImpairQueue::Packet &packet) {
+		udp_sendto(host.socket, packet.to, packet.bytes.data(), packet.bytes.size());
+	});
+}
+
+//handle one datagram from a connection's peer:
+static void udp_recv_datagram(
+	char const *where,
+	Connection &c,
+	uint8_t const *data, size_t size,
+	double now,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	UDPLink &link = *c.udp;
+	link.last_recv = now;
+	link.connected = true;
+
+	UDPKind kind = UDPKind(data[0]);
+	uint32_t ack = udp_read_u32(data + 1);
+	data += UDPHeaderSize;
+	size -= UDPHeaderSize;
+
+	//chunks the peer has now received:
+	while (!link.unacked.empty() && link.unacked.front().seq < ack) {
+		link.unacked.pop_front();
+		link.resend_at = now + UDPResendTime;
+	}
+
+	if (kind == UDPReliable && size >= 4) {
+		uint32_t seq = udp_read_u32(data);
+		if (seq == link.expected_seq) {
+			link.stream.append(data + 4, size - 4);
+			link.expected_seq += 1;
+
+			//hand over whole messages only, so that unreliable messages never land in the middle of one:
+			size_t used = 0;
+			MessageView message;
+			while (MessageView::frame(link.stream.data() + used, link.stream.size() - used, &message)) {
+				used += message.framed_size();
+			}
+			if (used != 0) {
+				c.recv_buffer.append(link.stream.data(), used);
+				link.stream.consume(used);
+				if (on_event) on_event(&c, Connection::OnRecv);
+			}
+		}
+		//(acknowledge duplicates and out-of-order chunks too, so the sender learns where the stream is)
+		link.ack_needed = true;
+	} else if (kind == UDPUnreliable && size >= 4) {
+		uint32_t seq = udp_read_u32(data);
+		MessageView message;
+		if (seq > link.newest_unreliable_seq
+		 && MessageView::frame(data + 4, size - 4, &message) && message.framed_size() == size - 4) {
+			link.newest_unreliable_seq = seq;
+			c.recv_buffer.append(data + 4, size - 4);
+			if (on_event) on_event(&c, Connection::OnRecv);
+		}
+	} else if (kind == UDPConnect) {
+		link.ack_needed = true;
+	} else if (kind == UDPDisconnect) {
+		std::cerr << "[" << where << "] peer disconnected." << std::endl;
+		link.peer_closed = true; //(so close() doesn't send one back)
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+	}
+}
+
+//UDP polling helper used by both server and client:
+void poll_connections_udp(
+	char const *where,
+	UDPHost &host,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout) {
+
+	double now = seconds_now();
+
+	auto flush = [&]() {
+		for (auto &c : connections) {
+			if (c.socket == InvalidSocket || !c.udp) continue;
+			udp_flush(c, now);
+		}
+		udp_send_impaired(host, now);
+	};
+	flush();
+
+	{ //wait (until timeout, or until a held-back datagram or resend is due) for datagrams to arrive:
+		double wait = timeout;
+		if (host.impaired) wait = std::min(wait, std::min(host.impaired->send.next_release(), host.impaired->recv.next_release()) - now);
+		for (auto const &c : connections) {
+			if (c.socket != InvalidSocket && c.udp && !c.udp->unacked.empty()) wait = std::min(wait, c.udp->resend_at - now);
+		}
+		wait = std::max(wait, 0.0);
+
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(host.socket, &read_fds);
+		struct timeval tv;
+		tv.tv_sec = std::lround(std::floor(wait));
+		tv.tv_usec = std::lround((wait - std::floor(wait)) * 1e6);
+		select(int(host.socket) + 1, &read_fds, NULL, NULL, &tv);
+	}
+	now = seconds_now();
+
+	//hand a datagram to the connection for its sender (opening one for a new client, if asked):
+	auto handle_datagram = [&](std::string const &peer, uint8_t const *data, size_t size) {
+		Connection *c = nullptr;
+		if (host.is_server) {
+			auto f = host.peers.find(peer);
+			if (f != host.peers.end()) {
+				c = f->second;
+			} else if (data[0] == UDPConnect) {
+				connections.emplace_back();
+				c = &connections.back();
+				c->socket = host.socket;
+				c->udp = std::make_shared< UDPLink >();
+				c->udp->host = &host;
+				c->udp->peer = peer;
+				c->udp->last_recv = now;
+				host.peers.emplace(peer, c);
+				std::cerr << "[" << where << "] client connected (udp)." << std::endl; //INFO
+				if (on_event) on_event(c, Connection::OnOpen);
+			}
+		} else {
+			assert(connections.size() == 1);
+			if (connections.front().udp && connections.front().udp->peer == peer) c = &connections.front();
+		}
+		if (c == nullptr || c->socket == InvalidSocket) return;
+
+		udp_recv_datagram(where, *c, data, size, now, on_event);
+	};
+
+	//read every datagram that has arrived:
+	while (true) {
+		static thread_local uint8_t buffer[UDPMaxDatagram + 1];
+		struct sockaddr_storage from;
 		#ifdef _WIN32
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
+		int from_len = int(sizeof(from));
+		int ret = recvfrom(host.socket, reinterpret_cast< char * >(buffer), int(sizeof(buffer)), 0, reinterpret_cast< struct sockaddr * >(&from), &from_len);
 		#else
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), c.send_buffer.size(), MSG_DONTWAIT);
-		#endif 
-		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-			//~no problem~, but don't keep trying
+		socklen_t from_len = sizeof(from);
+		ssize_t ret = recvfrom(host.socket, buffer, sizeof(buffer), 0, reinterpret_cast< struct sockaddr * >(&from), &from_len);
+		#endif
+		if (ret < 0) {
+			if (udp_would_block()) break;
+			std::cerr << "[" << where << "] recvfrom() returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
 			break;
-		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
-			if (ret < 0) {
-				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
-			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
-				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
-			}
+		}
+		if (size_t(ret) < UDPHeaderSize || size_t(ret) > UDPMaxDatagram) continue; //not ours
+
+		std::string peer = udp_address(reinterpret_cast< struct sockaddr const * >(&from), size_t(from_len));
+		if (host.impaired) {
+			ImpairedLink &impaired = *host.impaired;
+			impaired.recv.admit(*impaired.impairer, impaired.impairer->impairment.recv, now, peer, buffer, size_t(ret), false);
+		} else {
+			handle_datagram(peer, buffer, size_t(ret));
+		}
+	}
+
+	//handle datagrams that have come out of the host's simulated link:
+	if (host.impaired) {
+		host.impaired->recv.release(now, [&](ImpairQueue::Packet &packet) {
+			handle_datagram(packet.to, packet.bytes.data(), packet.bytes.size());
+		});
+	}
+
+	//give up on peers that have gone quiet:
+	for (auto &c : connections) {
+		if (c.socket == InvalidSocket || !c.udp) continue;
+		if (now - c.udp->last_recv > UDPTimeout) {
+			std::cerr << "[" << where << "] no datagrams for " << UDPTimeout << "s, disconnecting." << std::endl;
 			c.close();
 			if (on_event) on_event(&c, Connection::OnClose);
-		} else { //ret seems reasonable
-			c.send_buffer.erase(c.send_buffer.begin(), c.send_buffer.begin() + ret);
 		}
 	}
 
-		
+	//send acks (and anything queued by event handlers):
+	flush();
+
+	for (auto &c : connections) {
+		check_send_limit(where, c, on_event);
+	}
 }
 
 //---------------------------------
 
 
-Server::Server(std::string const &port) {
+Server::Server(std::string const &port, Transport transport_) : Server(port, DefaultBackend, transport_) {
+}
+
+Server::Server(std::string const &port, Backend backend_, Transport transport_) : backend(backend_), transport(transport_) {
 
 	#ifdef _WIN32
 	{ //init winsock:
@@ -199,7 +1047,7 @@ Server::Server(std::string const &port) {
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_socktype = (transport == Transport::UDP ? SOCK_DGRAM : SOCK_STREAM);
 		hints.ai_flags = AI_PASSIVE;
 
 		struct addrinfo *res = nullptr;
@@ -265,6 +1113,24 @@ Server::Server(std::string const &port) {
 		throw std::runtime_error("Failed to bind to port " + port);
 	}
 
+	if (transport == Transport::UDP) {
+		//every client's datagrams arrive on this one socket, which is read until it would block:
+		#ifdef _WIN32
+		unsigned long one = 1;
+		if (ioctlsocket(listen_socket, FIONBIO, &one) != 0) {
+		#else
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK) != 0) {
+		#endif
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to make udp socket non-blocking");
+		}
+		udp = std::make_shared< UDPHost >();
+		udp->socket = listen_socket;
+		udp->is_server = true;
+		return;
+	}
+
 	{ //listen on socket
 		int ret = ::listen(listen_socket, 5);
 		if (ret < 0) {
@@ -272,22 +1138,86 @@ Server::Server(std::string const &port) {
 			throw std::system_error(errno, std::system_category(), "failed to listen on socket");
 		}
 	}
+
+	if (backend == Epoll) {
+		#ifdef __linux__
+		//listen socket is drained with repeated accept() calls, so it must not block:
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK) != 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to make listen socket non-blocking");
+		}
+
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+		}
+
+		//listen socket is marked with a null pointer; connections are marked with their Connection *:
+		struct epoll_event evt;
+		evt.events = EPOLLIN | EPOLLET;
+		evt.data.ptr = nullptr;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &evt) != 0) {
+			closesocket(listen_socket);
+			closesocket(epoll_fd);
+			throw std::system_error(errno, std::system_category(), "failed to add listen socket to epoll instance");
+		}
+		#else
+		closesocket(listen_socket);
+		throw std::runtime_error("Server: the epoll backend is only available on linux.");
+		#endif
+	}
 }
 
-void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
+void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event_, double timeout) {
+	//impairment starts when it is first turned on (TCP connections already open when it does are left alone):
+	if (!impairer && impairment.active()) {
+		impairer = std::make_shared< Impairer >(impairment);
+		if (udp) udp->impaired = std::make_shared< ImpairedLink >(impairer.get());
+	}
+	if (impairer) impairer->update(impairment);
+
+	//new connections get this server's send_buffer limits (and impairment) before on_event_ sees them:
+	std::function< void(Connection *, Connection::Event event) > on_event = [&](Connection *c, Connection::Event evt) {
+		if (evt == Connection::OnOpen) {
+			c->send_high_water = send_high_water;
+			c->send_limit = send_limit;
+			if (impairer && !c->udp) c->impaired = std::make_shared< ImpairedLink >(impairer.get());
+		}
+		if (on_event_) on_event_(c, evt);
+	};
+
+	if (transport == Transport::UDP) {
+		poll_connections_udp("Server::poll", *udp, connections, on_event, timeout);
+	} else
+	#ifdef __linux__
+	if (backend == Epoll) {
+		poll_connections_epoll("Server::poll", epoll_fd, connections, pending, on_event, timeout, listen_socket, impairer.get());
+	} else
+	#endif
+	poll_connections("Server::poll", connections, on_event, timeout, listen_socket, impairer.get());
 
 	//reap closed clients:
+	// (the epoll backend knows whether any have closed, so it doesn't look through every connection on every poll)
+	bool tracked = (transport == Transport::TCP && backend == Epoll);
+	if (tracked && !pending.closed) return;
+	pending.closed = false;
 	for (auto connection = connections.begin(); connection != connections.end(); /*later*/) {
 		auto old = connection;
 		++connection;
 		if (old->socket == InvalidSocket) {
+			//(closed connections are still listed if they closed after the last flush)
+			if (old->listed) {
+				auto &output = pending.output;
+				output.erase(std::find(output.begin(), output.end(), &*old));
+			}
 			connections.erase(old);
 		}
 	}
 }
 
-Client::Client(std::string const &host, std::string const &port) : connections(1), connection(connections.front()) {
+Client::Client(std::string const &host, std::string const &port, Transport transport_) : connections(1), connection(connections.front()), transport(transport_) {
 	#ifdef _WIN32
 	{ //init winsock:
 		WSADATA info;
@@ -301,8 +1231,8 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_socktype = (transport == Transport::UDP ? SOCK_DGRAM : SOCK_STREAM);
+		hints.ai_protocol = (transport == Transport::UDP ? IPPROTO_UDP : IPPROTO_TCP);
 
 		struct addrinfo *res = nullptr;
 		int addrinfo_ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
@@ -311,8 +1241,15 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 		}
 
 		std::cout << "[Client::Client] connecting to " << host << ":" << port << ":" << std::endl;
+		//(UDP has no connect() to find out which address works, and servers usually bind IPv4, so prefer IPv4 there)
+		bool has_ipv4 = false;
+		for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
+			if (info->ai_family == AF_INET) has_ipv4 = true;
+		}
+
 		//based on example code in the 'man getaddrinfo' man page on OSX:
 		for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
+			if (transport == Transport::UDP && has_ipv4 && info->ai_family != AF_INET) continue;
 			{ //DEBUG: dump info about this address:
 				std::cout << "\ttrying ";
 				char ip[INET6_ADDRSTRLEN];
@@ -335,6 +1272,33 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 				std::cout << "(failed to create socket: " << strerror(errno) << ")" << std::endl;
 				continue;
 			}
+			if (transport == Transport::UDP) {
+				//no connection to make; just remember where the server is (the first poll() says hello):
+				#ifdef _WIN32
+				unsigned long one = 1;
+				if (ioctlsocket(s, FIONBIO, &one) != 0) {
+				#else
+				int flags = fcntl(s, F_GETFL, 0);
+				if (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) != 0) {
+				#endif
+					std::cout << "(failed to make socket non-blocking: " << strerror(errno) << ")" << std::endl;
+					closesocket(s);
+					continue;
+				}
+				std::cout << "ready (udp)." << std::endl;
+
+				udp = std::make_shared< UDPHost >();
+				udp->socket = s;
+				udp->is_server = false;
+				connection.socket = s;
+				connection.udp = std::make_shared< UDPLink >();
+				connection.udp->host = udp.get();
+				connection.udp->peer = udp_address(info->ai_addr, size_t(info->ai_addrlen));
+				connection.udp->owns_socket = true;
+				connection.udp->last_recv = seconds_now(); //(so the server has UDPTimeout to answer)
+				break;
+			}
+
 			int ret = connect(s, info->ai_addr, int(info->ai_addrlen));
 			if (ret < 0) {
 				std::cout << "(failed to connect: " << strerror(errno) << ")" << std::endl;
@@ -356,6 +1320,18 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 
 
 void Client::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Client::poll", connections, on_event, timeout, InvalidSocket);
+	//impairment starts when it is first turned on:
+	if (!impairer && impairment.active()) {
+		impairer = std::make_shared< Impairer >(impairment);
+		if (udp) udp->impaired = std::make_shared< ImpairedLink >(impairer.get());
+		else connection.impaired = std::make_shared< ImpairedLink >(impairer.get());
+	}
+	if (impairer) impairer->update(impairment);
+
+	if (transport == Transport::UDP) {
+		poll_connections_udp("Client::poll", *udp, connections, on_event, timeout);
+		return;
+	}
+	poll_connections("Client::poll", connections, on_event, timeout, InvalidSocket, impairer.get());
 }
 
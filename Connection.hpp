@@ -5,6 +5,13 @@
  * You don't create 'Connection' objects yourself, rather, you
  * create a Client or Server object which will manage connection(s)
  * for you.
+ *
+ * Client and Server can also talk over UDP (pass Transport::UDP), with the same Connection API:
+ *  - bytes sent normally arrive reliably and in order (as a stream of acknowledged, retransmitted datagrams);
+ *  - replaceable send_buffer segments (those with a tag, e.g., game state) are each sent as one unreliable datagram,
+ *    and the receiver drops any that arrive after a newer one.
+ *  Messages must be framed as in MessageView.hpp, since only whole messages are handed to recv_buffer.
+ *
  * For example:
 
 //simple server
@@ -14,7 +21,7 @@ int main(int argc, char **argv) {
 		server.poll([](Connection *connection, Connection::Event evt){
 			if (evt == Connection::OnRecv) {
 				//extract and erase data from the connection's recv_buffer:
-				std::vector< uint8_t > data = connection->recv_buffer;
+				std::vector< uint8_t > data(connection->recv_buffer.begin(), connection->recv_buffer.end());
 				connection->recv_buffer.clear();
 				//send to other connections:
 
@@ -61,13 +68,220 @@ int main(int argc, char **argv) {
 //--------- ---------------------------------- ---------
 
 #include <vector>
+#include <deque>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <functional>
 #include <cstdint>
+#include <cstring>
+#include <cassert>
+
+//how Client and Server talk to each other:
+enum class Transport {
+	TCP,
+	UDP, //(see above)
+};
+
+//simulated network trouble, for reproducing bad links on one machine (loopback):
+// traffic in each direction passes through a simulated link that sends at most 'bandwidth' bytes per second,
+// then holds each packet for 'latency' plus up to 'jitter' seconds.
+// Packets are datagrams (UDP transport) or pieces of the byte stream (TCP transport, cut into ~MTU-sized packets).
+// TCP streams stay reliable and in order: a "lost" packet (and everything behind it) is held up by a retransmit delay instead.
+struct Impairment {
+	struct Direction {
+		double latency = 0.0; //seconds each packet is held
+		double jitter = 0.0; //seconds; each packet is held up to this much longer, at random (without reordering)
+		double bandwidth = 0.0; //bytes per second (0 => unlimited)
+		double loss = 0.0; //chance each packet is lost
+		double reorder = 0.0; //(UDP only) chance each packet skips the latency and overtakes those being held
+
+		bool active() const { return latency > 0.0 || jitter > 0.0 || bandwidth > 0.0 || loss > 0.0 || reorder > 0.0; }
+	};
+	Direction send; //applied to traffic leaving this end
+	Direction recv; //applied to traffic arriving at this end
+	uint32_t seed = 1; //random choices (loss, jitter, reorder) are repeatable for a given seed
+
+	bool active() const { return send.active() || recv.active(); }
+
+	//parse a comma-separated list of settings, e.g., "latency=50ms,jitter=10ms,loss=2%,bandwidth=64k,seed=3":
+	// latency, jitter, bandwidth, loss, and reorder set both directions; prefix with "send." or "recv." to set one.
+	// Values may have a suffix: "ms" or "s" for times, "k" or "M" for bytes per second, "%" for chances.
+	// (throws on a malformed spec)
+	static Impairment parse(std::string const &spec);
+
+	//the impairment described by the NET_IMPAIR environment variable (none if it isn't set):
+	static Impairment from_env();
+};
+
+struct Impairer; //per-Server / per-Client impairment state, in Connection.cpp
+struct ImpairedLink; //per-connection (TCP) or per-socket (UDP) simulated link, in Connection.cpp
+
+struct UDPLink; //(UDP transport) per-connection reliability state, in Connection.cpp
+struct UDPHost; //(UDP transport) per-socket state, in Connection.cpp
 
 //Thin wrapper around a (polling-based) TCP socket connection:
 struct Connection {
+	//Byte queue used for recv_buffer:
+	// bytes are appended at the write end and removed from the read end with consume(),
+	// which just advances a cursor instead of shifting the remaining bytes down.
+	// Consumed space is reclaimed (with one move of the unread bytes) only once it outweighs the unread data,
+	// so consuming many small messages costs time proportional to the messages, not to the bytes still buffered.
+	// Unread bytes are always contiguous, so they can be handed directly to send() or parsed in place.
+	struct Buffer {
+		size_t size() const { return storage.size() - head; }
+		bool empty() const { return storage.size() == head; }
+
+		uint8_t *data() { return storage.data() + head; }
+		uint8_t const *data() const { return storage.data() + head; }
+		uint8_t *begin() { return data(); }
+		uint8_t const *begin() const { return data(); }
+		uint8_t *end() { return storage.data() + storage.size(); }
+		uint8_t const *end() const { return storage.data() + storage.size(); }
+
+		uint8_t &operator[](size_t i) { assert(i < size()); return storage[head + i]; }
+		uint8_t const &operator[](size_t i) const { assert(i < size()); return storage[head + i]; }
+
+		//add bytes at the write end:
+		void append(void const *bytes, size_t count) {
+			if (head != 0 && head >= size()) {
+				//more consumed than unread bytes: move unread bytes to the front and reuse the space.
+				std::memmove(storage.data(), storage.data() + head, size());
+				storage.resize(size());
+				head = 0;
+			}
+			storage.insert(storage.end(), reinterpret_cast< uint8_t const * >(bytes), reinterpret_cast< uint8_t const * >(bytes) + count);
+		}
+
+		//remove bytes from the read end:
+		void consume(size_t count) {
+			assert(count <= size());
+			head += count;
+			if (head == storage.size()) clear();
+		}
+
+		void clear() {
+			storage.clear();
+			head = 0;
+		}
+
+	private:
+		std::vector< uint8_t > storage; //unread bytes are storage[head, storage.size())
+		size_t head = 0; //read cursor
+	};
+
+	//Chain of byte segments used for send_buffer:
+	// each segment is some bytes owned by the queue followed (optionally) by bytes shared with other queues,
+	// so a payload sent to many connections is stored once and only referenced by each queue.
+	// Sockets are written with one scatter-gather call (sendmsg / WSASend) over several segments.
+	struct SendQueue {
+		struct Segment {
+			std::vector< uint8_t > owned; //sent first
+			std::shared_ptr< std::vector< uint8_t > const > shared; //sent after 'owned' (if not null)
+			uint8_t tag = 0; //nonzero => replaceable by a newer segment with the same tag (see append_shared)
+			size_t sent = 0; //bytes already sent from the front of the segment
+
+			size_t size() const { return owned.size() + (shared ? shared->size() : 0); }
+		};
+
+		size_t size() const { return bytes; }
+		bool empty() const { return bytes == 0; }
+
+		//copy bytes to the end of the queue:
+		void append(void const *data, size_t count) {
+			if (segments.empty() || segments.back().shared || segments.back().tag != 0) {
+				segments.emplace_back();
+			}
+			std::vector< uint8_t > &owned = segments.back().owned;
+			owned.insert(owned.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + count);
+			bytes += count;
+		}
+
+		//queue a segment made of 'prefix' (copied) followed by 'shared' (referenced; must not change while queued):
+		// if 'tag' is nonzero, any queued segment with the same tag that hasn't started sending is dropped first,
+		// so a socket that is backed up only ever holds the newest one.
+		//returns the number of segments dropped.
+		uint32_t append_shared(void const *prefix, size_t prefix_count, std::shared_ptr< std::vector< uint8_t > const > shared, uint8_t tag = 0) {
+			uint32_t dropped = 0;
+			if (tag != 0) {
+				for (auto s = segments.begin(); s != segments.end(); /* later */) {
+					if (s->tag == tag && s->sent == 0) {
+						bytes -= s->size();
+						s = segments.erase(s);
+						dropped += 1;
+					} else {
+						++s;
+					}
+				}
+			}
+			segments.emplace_back();
+			Segment &segment = segments.back();
+			segment.owned.assign(reinterpret_cast< uint8_t const * >(prefix), reinterpret_cast< uint8_t const * >(prefix) + prefix_count);
+			segment.shared = std::move(shared);
+			segment.tag = tag;
+			bytes += segment.size();
+			return dropped;
+		}
+
+		//call 'f(uint8_t const *data, size_t count)' on each contiguous piece of unsent bytes, in order,
+		// until it returns 'false':
+		template< typename F >
+		void for_each_piece(F const &f) const {
+			for (Segment const &segment : segments) {
+				size_t skip = segment.sent;
+				if (skip < segment.owned.size()) {
+					if (!f(segment.owned.data() + skip, segment.owned.size() - skip)) return;
+					skip = 0;
+				} else {
+					skip -= segment.owned.size();
+				}
+				if (segment.shared && skip < segment.shared->size()) {
+					if (!f(segment.shared->data() + skip, segment.shared->size() - skip)) return;
+				}
+			}
+		}
+
+		//remove sent bytes from the front:
+		void consume(size_t count) {
+			assert(count <= bytes);
+			bytes -= count;
+			while (count > 0) {
+				Segment &front = segments.front();
+				size_t left = front.size() - front.sent;
+				if (count < left) {
+					front.sent += count;
+					break;
+				}
+				count -= left;
+				segments.pop_front();
+			}
+		}
+
+		//remove every tagged segment that hasn't started sending, calling 'f(Segment const &)' on each, in order:
+		// (lets a transport send replaceable segments separately from the rest of the bytes)
+		template< typename F >
+		void take_tagged(F const &f) {
+			for (auto s = segments.begin(); s != segments.end(); /* later */) {
+				if (s->tag != 0 && s->sent == 0) {
+					f(*s);
+					bytes -= s->size();
+					s = segments.erase(s);
+				} else {
+					++s;
+				}
+			}
+		}
+
+		void clear() {
+			segments.clear();
+			bytes = 0;
+		}
+
+		std::deque< Segment > segments;
+		size_t bytes = 0; //unsent bytes in all segments
+	};
+
 	//Helper that will append any type to the send buffer:
 	template< typename T >
 	void send(T const &t) {
@@ -75,7 +289,14 @@ struct Connection {
 	}
 	//Helper that will append raw bytes to the send buffer:
 	void send_raw(void const *data, size_t size) {
-		send_buffer.insert(send_buffer.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+		send_buffer.append(data, size);
+		queued();
+	}
+	//Helper that will append a shared payload to the send buffer (see SendQueue::append_shared):
+	uint32_t send_shared(void const *prefix, size_t prefix_count, std::shared_ptr< std::vector< uint8_t > const > shared, uint8_t tag = 0) {
+		uint32_t dropped = send_buffer.append_shared(prefix, prefix_count, std::move(shared), tag);
+		queued();
+		return dropped;
 	}
 
 	//Call 'close' to mark a connection for discard:
@@ -84,13 +305,39 @@ struct Connection {
 	//so you can if(connection) ... to check for validity:
 	explicit operator bool() { return socket != InvalidSocket; }
 
-	//To send data over a connection, append it to send_buffer:
-	std::vector< uint8_t > send_buffer;
-	//When the connection receives data, it is appended to recv_buffer:
-	std::vector< uint8_t > recv_buffer;
+	//To send data over a connection, append it to send_buffer with send(), send_raw(), or send_shared():
+	// (so that a Server using the epoll backend knows to send it)
+	SendQueue send_buffer;
+	//limits on send_buffer's size, in bytes (0 => no limit):
+	// above 'send_high_water', senders of droppable data (e.g., game state) should skip this connection;
+	// past 'send_limit', the connection is closed (the other end has probably stopped reading).
+	size_t send_high_water = 0;
+	size_t send_limit = 0;
+	//When the connection receives data, it is appended to recv_buffer (consume() it once handled):
+	Buffer recv_buffer;
 
 	//internals:
-	Socket socket = InvalidSocket;
+	Socket socket = InvalidSocket; //(UDP transport) the Server's or Client's socket
+	bool writable = true; //(epoll backend) false once send() would block, until the next EPOLLOUT edge
+
+	//(epoll backend) connections the server's poll needs to visit besides those with socket events:
+	struct Pending {
+		std::mutex mutex; //(guards 'output'; connections in different matches may queue output on different threads)
+		std::vector< Connection * > output; //connections that may have output waiting, each at most once (see 'listed')
+		bool closed = false; //a connection was closed since the server last reaped closed connections
+	};
+	Pending *pending = nullptr; //the server's list (nullptr => not tracked: select backend, UDP transport, or client)
+	bool listed = false; //in pending->output
+
+	//list this connection as having output waiting (if it isn't already):
+	void queued() {
+		if (!pending || listed) return;
+		std::lock_guard< std::mutex > lock(pending->mutex);
+		pending->output.emplace_back(this);
+		listed = true;
+	}
+	std::shared_ptr< UDPLink > udp; //(UDP transport) reliability state for this peer; nullptr for TCP connections
+	std::shared_ptr< ImpairedLink > impaired; //(TCP transport) traffic held back by impairment; nullptr unless impairment is on
 
 	enum Event {
 		OnOpen,
@@ -100,7 +347,19 @@ struct Connection {
 };
 
 struct Server {
-	Server(std::string const &port); //pass the port number to listen on, as a string (servname, really)
+	//how poll() waits for socket events:
+	enum Backend {
+		Select, //portable; rebuilds fd_sets over every connection on each poll (at most FD_SETSIZE sockets)
+		Epoll, //linux only; sockets are registered once (edge-triggered) and poll only visits sockets with events or queued output
+	};
+	#ifdef __linux__
+	static constexpr Backend DefaultBackend = Epoll;
+	#else
+	static constexpr Backend DefaultBackend = Select;
+	#endif
+
+	Server(std::string const &port, Backend backend = DefaultBackend, Transport transport = Transport::TCP); //pass the port number to listen on, as a string (servname, really)
+	Server(std::string const &port, Transport transport); //(with the default backend; the backend doesn't matter for Transport::UDP)
 
 	//poll() updates the list of active connections and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -110,12 +369,25 @@ struct Server {
 	);
 
 	std::list< Connection > connections;
-	Socket listen_socket = InvalidSocket;
+	Socket listen_socket = InvalidSocket; //(UDP transport) the socket all datagrams arrive on
+
+	//send_buffer limits given to each new connection (see Connection::send_high_water / send_limit):
+	size_t send_high_water = 64 * 1024;
+	size_t send_limit = 1024 * 1024;
+
+	Backend backend;
+	Socket epoll_fd = InvalidSocket; //(epoll backend) instance holding listen_socket and every connection's socket
+	Connection::Pending pending; //(epoll backend) connections with output waiting, and whether any have closed
+
+	Transport transport = Transport::TCP;
+	std::shared_ptr< UDPHost > udp; //(UDP transport) state for listen_socket, which is the only socket
+	Impairment impairment; //applied to traffic to and from clients (for testing; see Impairment)
+	std::shared_ptr< Impairer > impairer; //(created once impairment is active)
 };
 
 
 struct Client {
-	Client(std::string const &host, std::string const &port);
+	Client(std::string const &host, std::string const &port, Transport transport = Transport::TCP);
 
 	//poll() checks the status of the active connection and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -126,4 +398,9 @@ struct Client {
 
 	std::list< Connection > connections; //will only ever contain exactly one connection
 	Connection &connection; //reference to the only connection in the connections list
+
+	Transport transport = Transport::TCP;
+	std::shared_ptr< UDPHost > udp; //(UDP transport) state for connection.socket
+	Impairment impairment; //applied to traffic to and from the server (for testing; see Impairment)
+	std::shared_ptr< Impairer > impairer; //(created once impairment is active)
 };
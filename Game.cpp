@@ -1,6 +1,7 @@
 #include "Game.hpp"
 
 #include "Connection.hpp"
+#include "MessageView.hpp"
 #include "data_path.hpp"
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -8,18 +9,40 @@
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 
 #include <glm/gtx/norm.hpp>
+#include <glm/gtc/packing.hpp>
+
+//add presses to a button (downs stops counting at 255):
+static void add_downs(Button *button, uint32_t downs) {
+	uint32_t d = uint32_t(button->downs) + downs;
+	if (d > 255) {
+		std::cerr << "got a whole lot of downs" << std::endl;
+		d = 255;
+	}
+	button->downs = uint8_t(d);
+}
+
+Player::Command Player::Controls::command(uint32_t seq, float elapsed) const {
+	Command command;
+	command.seq = seq;
+	command.elapsed = std::min(std::max(elapsed, 0.0f), Command::MaxElapsed);
+	command.left = left.pressed;
+	command.right = right.pressed;
+	command.up = up.pressed;
+	command.down = down.pressed;
+	command.mouse_x = mouse_x;
+	return command;
+}
 
-void Player::Controls::send_controls_message(Connection *connection_) const {
+void Player::Controls::send_controls_message(Connection *connection_, uint32_t seq, float elapsed) const {
 	assert(connection_);
 	auto &connection = *connection_;
 
-	uint32_t size = 10;
-	connection.send(Message::C2S_Controls);
-	connection.send(uint8_t(size));
-	connection.send(uint8_t(size >> 8));
-	connection.send(uint8_t(size >> 16));
+	uint32_t size = 18;
+	MessageView::send_header(&connection, Message::C2S_Controls, size);
 
 	auto send_button = [&](Button const &b) {
 		if (b.downs & 0x80) {
@@ -35,92 +58,97 @@ void Player::Controls::send_controls_message(Connection *connection_) const {
 	send_button(jump);
 	send_button(LMB);
 	connection.send(mouse_x);
+	connection.send(seq);
+	connection.send(elapsed);
 }
 
-bool Player::Controls::recv_controls_message(Connection *connection_) {
-	assert(connection_);
-	auto &connection = *connection_;
-
-	auto &recv_buffer = connection.recv_buffer;
+Player::Command Player::Controls::recv_controls_message(MessageView const &message) {
+	assert(message.type == uint8_t(Message::C2S_Controls));
+	if (message.size != 18) throw std::runtime_error("Controls message with size " + std::to_string(message.size) + " != 18!");
 
-	//expecting [type, size_low0, size_mid8, size_high8]:
-	if (recv_buffer.size() < 4) return false;
-	if (recv_buffer[0] != uint8_t(Message::C2S_Controls)) return false;
-	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
-	              | (uint32_t(recv_buffer[2]) << 8)
-	              |  uint32_t(recv_buffer[1]);
-	if (size != 10) throw std::runtime_error("Controls message with size " + std::to_string(size) + " != 10!");
-	
-	//expecting complete message:
-	if (recv_buffer.size() < 4 + size) return false;
+	MessageView::Reader reader = message.reader();
 
-	auto recv_button = [](uint8_t byte, Button *button) {
+	auto recv_button = [&](Button *button) {
+		uint8_t byte = reader.read< uint8_t >();
 		button->pressed = (byte & 0x80);
-		uint32_t d = uint32_t(button->downs) + uint32_t(byte & 0x7f);
-		if (d > 255) {
-			std::cerr << "got a whole lot of downs" << std::endl;
-			d = 255;
-		}
-		button->downs = uint8_t(d);
+		add_downs(button, byte & 0x7f);
 	};
 
-	recv_button(recv_buffer[4+0], &left);
-	recv_button(recv_buffer[4+1], &right);
-	recv_button(recv_buffer[4+2], &up);
-	recv_button(recv_buffer[4+3], &down);
-	recv_button(recv_buffer[4+4], &jump);
-	recv_button(recv_buffer[4+5], &LMB);
-	mouse_x = reinterpret_cast<float*>(&recv_buffer[10])[0];
+	recv_button(&left);
+	recv_button(&right);
+	recv_button(&up);
+	recv_button(&down);
+	recv_button(&jump);
+	recv_button(&LMB);
+	reader.read(&mouse_x);
+	uint32_t seq = reader.read< uint32_t >();
+	float elapsed = reader.read< float >();
+	reader.finish();
+
+	if (!std::isfinite(mouse_x) || !std::isfinite(elapsed)) throw std::runtime_error("Controls message with non-finite mouse_x or elapsed.");
+	return command(seq, elapsed);
+}
 
-	//delete message from buffer:
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+void Player::Controls::add(Controls const &received) {
+	auto add_button = [](Button *button, Button const &from) {
+		button->pressed = from.pressed;
+		add_downs(button, from.downs);
+	};
 
-	return true;
+	add_button(&left, received.left);
+	add_button(&right, received.right);
+	add_button(&up, received.up);
+	add_button(&down, received.down);
+	add_button(&jump, received.jump);
+	add_button(&LMB, received.LMB);
+	mouse_x = received.mouse_x;
 }
 
 
 //-----------------------------------------
 
 Game::Game() {
-	main_scene_server = Scene(data_path("arena.scene"), nullptr);
-	for (auto &transform : main_scene_server.transforms) {
-		if (transform.name == "RedHamster") {
-			hamster_red.hamster_transform = &transform;
-		}
-		else if (transform.name == "BlueHamster") {
-			hamster_blue.hamster_transform = &transform;
-		}
-		else if (transform.name == "BlueLance") {
-			hamster_blue.lance_transform = &transform;
-		}
-		else if (transform.name == "BlueWheel") {
-			hamster_blue.wheel_transform = &transform;
-		}
-		else if (transform.name == "RedLance") {
-			hamster_red.lance_transform = &transform;
-		}
-		else if (transform.name == "RedWheel") {
-			hamster_red.wheel_transform = &transform;
-		}
-	}
+	//every game starts from the same arena, so only read it from disk once:
+	static Scene const arena(data_path("arena.scene"), nullptr);
+	main_scene_server = arena;
+	std::vector< Scene::Transform * > found = main_scene_server.find_transforms({
+		"RedHamster", "RedLance", "RedWheel", "RedLancePoint",
+		"BlueHamster", "BlueLance", "BlueWheel", "BlueLancePoint",
+	});
+	hamster_red.hamster_transform = found[0];
+	hamster_red.lance_transform = found[1];
+	hamster_red.wheel_transform = found[2];
+	lance_tip_transform[0] = found[3];
+	hamster_blue.hamster_transform = found[4];
+	hamster_blue.lance_transform = found[5];
+	hamster_blue.wheel_transform = found[6];
+	lance_tip_transform[1] = found[7];
 	reset_hamsters();
+	//(so world_matrix() can look up the lance tips)
+	main_scene_server.update_world();
 }
 
 Player *Game::spawn_player() {
+	uint8_t index;
 	if (next_player_number < 2) {
-		player_ready[next_player_number] = true;
 		std::cout<< "Player "<<std::to_string(next_player_number)<< " Ready!\n";
-		return &players[next_player_number++];
+		index = next_player_number++;
 	}
 	else if (!player_ready[0]) {
-		player_ready[0] = true;
-		return &players[0];
+		index = 0;
 	}
 	else if (!player_ready[1]) {
-		player_ready[1] = true;
-		return &players[1];
+		index = 1;
+	}
+	else {
+		return nullptr; // spectator is the nullptr
 	}
-	return nullptr; // spectator is the nullptr
+	player_ready[index] = true;
+	//a new client's commands start over:
+	commands[index].clear();
+	last_command[index] = 0;
+	move_budget[index] = 0.0f;
+	return &players[index];
 }
 
 void Game::remove_player(Player *player) {
@@ -141,18 +169,71 @@ void Game::remove_player(Player *player) {
 }
 
 void Game::update(float elapsed) {
+	tick += 1;
+
 	if (game_state == GameState::Ended) {
+		//controls keep arriving after a game ends, but nothing moves until the next one, so they're dropped:
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (!commands[i].empty()) last_command[i] = commands[i].back().seq;
+			commands[i].clear();
+			move_budget[i] = 0.0f;
+		}
 		since_ended += elapsed;
 		if (since_ended > 5.0f) {
 			reset_game();
 		}
 		return;
 	}
+
+	//the simulation advances in fixed steps of (about) SimStep however long a tick is,
+	// so a server ticking at 30, 60, or 120Hz plays out the same:
+	uint32_t steps = std::max(uint32_t(elapsed / SimStep + 0.5f), 1u);
+	float step_elapsed = elapsed / float(steps);
+	std::array< float, 2 > command_time = {0.0f, 0.0f}; //(how far into the tick each player's next command starts)
+	for (uint32_t s = 0; s < steps && game_state != GameState::Ended; ++s) {
+		//each client command is applied in the step its midpoint falls in, if the player's budget covers it:
+		// (with a little leeway, since step lengths and command lengths don't add up exactly)
+		std::array< size_t, 2 > due = {0, 0};
+		for (uint32_t i = 0; i < 2; ++i) {
+			move_budget[i] += step_elapsed;
+			float used = 0.0f;
+			while (due[i] < commands[i].size()
+				&& used + commands[i][due[i]].elapsed <= move_budget[i] + 1e-4f
+				&& (s + 1 == steps || command_time[i] + 0.5f * commands[i][due[i]].elapsed < step_elapsed * float(s + 1))) {
+				used += commands[i][due[i]].elapsed;
+				command_time[i] += commands[i][due[i]].elapsed;
+				due[i] += 1;
+			}
+		}
+		step(step_elapsed, due, float(s) / float(steps), float(s + 1) / float(steps));
+	}
+
+	//commands the budget didn't cover wait for the next update, but only up to MoveSlack's worth;
+	// older ones are dropped (e.g., a burst from a client catching up after the server already moved its hamster):
+	for (uint32_t i = 0; i < 2; ++i) {
+		float queued = 0.0f;
+		for (Player::Command const &command : commands[i]) {
+			queued += command.elapsed;
+		}
+		while (queued > MoveSlack) {
+			queued -= commands[i].front().elapsed;
+			last_command[i] = commands[i].front().seq;
+			commands[i].pop_front();
+		}
+	}
+
+	//remember where the hamsters ended up, for rewinding later hits:
+	PastTick &past = past_ticks[tick % past_ticks.size()];
+	past.tick = tick;
+	past.position = { players[0].position, players[1].position };
+}
+
+void Game::step(float elapsed, std::array< size_t, 2 > const &due, float tick_from, float tick_to) {
 	// cache last hamster position for collision check
 	glm::vec3 hamster_last_pos[2] = {players[0].position, players[1].position};
 	glm::vec3 lance_last_pos[2] = {
-		glm::vec3(lance_tip_transform[0]->make_local_to_world() * glm::vec4(lance_tip_transform[0]->position, 1.0f)), 
-		glm::vec3(lance_tip_transform[1]->make_local_to_world() * glm::vec4(lance_tip_transform[1]->position, 1.0f)), 
+		glm::vec3(main_scene_server.world_matrix(*lance_tip_transform[0]) * glm::vec4(lance_tip_transform[0]->position, 1.0f)),
+		glm::vec3(main_scene_server.world_matrix(*lance_tip_transform[1]) * glm::vec4(lance_tip_transform[1]->position, 1.0f)),
 	};
 	//position/velocity update:
 	for (uint8_t i = 0; i<2; ++i) {
@@ -189,26 +270,33 @@ void Game::update(float elapsed) {
 		}
 
 
-		//rotating the hamster view using mouse
-		if (p.controls.mouse_x != 0.0f) {
-			p.rotation = glm::normalize(
-				p.rotation
-				* glm::angleAxis(-p.controls.mouse_x * 3.0f, glm::vec3(0.0f, 0.0f, 1.0f))
-			);
+		//steering and movement, one client frame at a time (the same way clients predict it):
+		for (size_t c = 0; c < due[i]; ++c) {
+			move_player(p, commands[i].front());
+			move_budget[i] -= commands[i].front().elapsed;
+			last_command[i] = commands[i].front().seq;
+			commands[i].pop_front();
+		}
+		//if the player's commands have fallen more than MoveSlack behind (client stalled or stopped sending),
+		// the server moves the hamster for the rest, as if nothing were pressed (so it drifts and takes knockback):
+		if (move_budget[i] > MoveSlack) {
+			Player::Command coast;
+			coast.elapsed = move_budget[i] - MoveSlack;
+			move_player(p, coast);
+			move_budget[i] = MoveSlack;
 		}
 
 		//lance rotation, only applicable when not in attack or cooldown
 		if (p.since_attack == 0.0f) {
 			if (p.controls.jump.pressed) {
-				static float direction = 1.0f;
-				p.cur_lance_angle += direction * 90.0f * elapsed;
+				p.cur_lance_angle += p.lance_sweep * 90.0f * elapsed;
 				if (p.cur_lance_angle > 60.0f) {
 					p.cur_lance_angle = 60.0f;
-					direction = -1.0f;
+					p.lance_sweep = -1.0f;
 				}
 				else if (p.cur_lance_angle < -15.0f) {
 					p.cur_lance_angle = -15.0f;
-					direction = 1.0f;
+					p.lance_sweep = 1.0f;
 				}
 				p.lance_rotation = initial_player_state[i].lance_rotation* glm::angleAxis(
 					glm::radians(p.cur_lance_angle),
@@ -216,50 +304,20 @@ void Game::update(float elapsed) {
 				);
 			}
 		}
-		glm::vec3 dir = glm::vec3(0.0f);
-		if (p.controls.down.pressed) dir.y += 1.0f;
-		if (p.controls.up.pressed) dir.y -= 1.0f;
-		if (p.controls.left.pressed) dir.x += 1.0f;
-		if (p.controls.right.pressed) dir.x -= 1.0f;
-
-		glm::vec3 wheel_rotation = dir;
-
-		dir = p.rotation * dir;
-
-		if (dir == glm::vec3(0.0f)) {
-			//no inputs: just drift to a stop
-			float amt = 1.0f - std::pow(0.5f, elapsed / (PlayerAccelHalflife * 2.0f));
-			p.velocity = glm::mix(p.velocity, glm::vec3(0.0f), amt);
-		} else {
-			//inputs: tween velocity to target direction
-			dir = glm::normalize(dir);
-
-			float amt = 1.0f - std::pow(0.5f, elapsed / PlayerAccelHalflife);
-
-			//accelerate along velocity (if not fast enough):
-			float along = glm::dot(p.velocity, dir);
-			if (along < PlayerSpeed) {
-				along = glm::mix(along, PlayerSpeed, amt);
-			}
-
-			//damp perpendicular velocity:
-			float perp = glm::dot(p.velocity, glm::vec3(-dir.y, dir.x, 0.0f));
-			perp = glm::mix(perp, 0.0f, amt);
-
-			p.velocity = dir * along + glm::vec3(-dir.y, dir.x, 0.0f) * perp;
-		}
-		p.position += p.velocity * elapsed;
-		static float rotate_angle[2] = {0.0f, 0.0f};
+		glm::vec3 wheel_rotation = glm::vec3(0.0f);
+		if (p.controls.down.pressed) wheel_rotation.y += 1.0f;
+		if (p.controls.up.pressed) wheel_rotation.y -= 1.0f;
+		if (p.controls.left.pressed) wheel_rotation.x += 1.0f;
+		if (p.controls.right.pressed) wheel_rotation.x -= 1.0f;
 
 		//spin the wheel based on velocity and input direction
-		rotate_angle[i] -= glm::length(p.velocity) * elapsed * .5f;
-		rotate_angle[i] = std::fmod(rotate_angle[i], 360.0f);
+		p.wheel_spin -= glm::length(p.velocity) * elapsed * .5f;
+		p.wheel_spin = std::fmod(p.wheel_spin, 360.0f);
 
 		p.wheel_rotation = initial_player_state[i].wheel_rotation; 
 
 
-		const static float amt = 1.0f - std::pow(0.5f, elapsed / (.1f * 2.0f));
-		static float last_wheel_x_angle[2] = {0.0f,0.0f};
+		float amt = 1.0f - std::pow(0.5f, elapsed / (.1f * 2.0f));
 		
 		if (wheel_rotation != glm::vec3(0.0f)) {
 			float angle = 0.0f;
@@ -293,36 +351,18 @@ void Game::update(float elapsed) {
 					angle = .5f * float(M_PI);
 				}
 			}
-			// angle = abs(angle - float(M_PI) - last_wheel_x_angle[i]) <= abs(angle - last_wheel_x_angle[i]) ? angle - float(M_PI) : angle;
-			// std::cout<< angle << ", "<<last_wheel_x_angle[i]<<std::endl;
-			last_wheel_x_angle[i] = glm::mix(last_wheel_x_angle[i], angle, amt);
+			// angle = abs(angle - float(M_PI) - p.wheel_steer) <= abs(angle - p.wheel_steer) ? angle - float(M_PI) : angle;
+			// std::cout<< angle << ", "<<p.wheel_steer<<std::endl;
+			p.wheel_steer = glm::mix(p.wheel_steer, angle, amt);
 		}
 		else {
-			last_wheel_x_angle[i] = glm::mix(last_wheel_x_angle[i], 0.0f, amt);
+			p.wheel_steer = glm::mix(p.wheel_steer, 0.0f, amt);
 		}
-		p.wheel_rotation *= glm::angleAxis(last_wheel_x_angle[i], glm::vec3(1.0f, 0.0f, 0.0f)) * glm::angleAxis(
-			rotate_angle[i],
+		p.wheel_rotation *= glm::angleAxis(p.wheel_steer, glm::vec3(1.0f, 0.0f, 0.0f)) * glm::angleAxis(
+			p.wheel_spin,
 			glm::vec3(0.0f, 0.0f, 1.0f)
 		);
 
-		// player/arena collisions:
-		if (p.position.x < ArenaMin.x + PlayerRadius) {
-			p.position.x = ArenaMin.x + PlayerRadius;
-			p.velocity.x = std::abs(p.velocity.x) * 0.5f;
-		}
-		if (p.position.x > ArenaMax.x - PlayerRadius) {
-			p.position.x = ArenaMax.x - PlayerRadius;
-			p.velocity.x =-std::abs(p.velocity.x) * 0.5f;
-		}
-		if (p.position.y < ArenaMin.y + PlayerRadius) {
-			p.position.y = ArenaMin.y + PlayerRadius;
-			p.velocity.y = std::abs(p.velocity.y) * 0.5f;
-		}
-		if (p.position.y > ArenaMax.y - PlayerRadius) {
-			p.position.y = ArenaMax.y - PlayerRadius;
-			p.velocity.y =-std::abs(p.velocity.y) * 0.5f;
-		}
-
 		//reset 'downs' since controls have been handled:
 		p.controls.left.downs = 0;
 		p.controls.right.downs = 0;
@@ -365,26 +405,46 @@ void Game::update(float elapsed) {
 	}
 
 	glm::vec3 lance_cur_pos[2] = {
-		glm::vec3(lance_tip_transform[0]->make_local_to_world() * glm::vec4(lance_tip_transform[0]->position, 1.0f)), 
-		glm::vec3(lance_tip_transform[1]->make_local_to_world() * glm::vec4(lance_tip_transform[1]->position, 1.0f))
+		glm::vec3(main_scene_server.world_matrix(*lance_tip_transform[0]) * glm::vec4(lance_tip_transform[0]->position, 1.0f)),
+		glm::vec3(main_scene_server.world_matrix(*lance_tip_transform[1]) * glm::vec4(lance_tip_transform[1]->position, 1.0f))
 	};
+	//lag compensation: each lance is tested against the other hamster as the attacker's client was drawing it
+	// (this step's share of the motion recorded at the attacker's view_tick, if that is recent enough):
+	glm::vec3 target_pos[2] = { players[0].position, players[1].position };
+	glm::vec3 target_motion[2] = { players[0].position - hamster_last_pos[0], players[1].position - hamster_last_pos[1] };
+	for (uint32_t target = 0; target < 2; ++target) {
+		uint32_t attacker = 1 - target;
+		uint32_t max_ticks = std::min(uint32_t(std::max(max_rewind, 0.0f) / tick_length() + 0.5f), uint32_t(past_ticks.size()) - 2);
+		if (view_tick[attacker] == 0 || view_tick[attacker] >= tick || max_ticks == 0) continue;
+		//views further back than max_rewind are clamped to it:
+		uint32_t view = std::max(view_tick[attacker], tick > max_ticks ? tick - max_ticks : 0);
+		if (view == 0) continue;
+		PastTick const &at = past_ticks[view % past_ticks.size()];
+		PastTick const &before = past_ticks[(view - 1) % past_ticks.size()];
+		if (at.tick != view || before.tick != view - 1) continue;
+		glm::vec3 from = glm::mix(before.position[target], at.position[target], tick_from);
+		target_pos[target] = glm::mix(before.position[target], at.position[target], tick_to);
+		target_motion[target] = target_pos[target] - from;
+	}
+
+	//(the swept test takes velocities, since it compares the time of contact with 'elapsed')
 	glm::vec3 blue_lance_direction = lance_cur_pos[1] - lance_last_pos[1];
-	if (players[1].since_attack != 0.0f && !players[1].has_hit_this_attack && sphere_point_intersection(players[0].position, PlayerRadius, 
-		lance_cur_pos[1], players[0].position - hamster_last_pos[0], blue_lance_direction, elapsed)) {
+	if (players[1].since_attack != 0.0f && !players[1].has_hit_this_attack && sphere_point_intersection(target_pos[0], PlayerRadius, 
+		lance_cur_pos[1], target_motion[0] / elapsed, blue_lance_direction / elapsed, elapsed)) {
 		//player 0 got hit
 		players[1].has_hit_this_attack = true;
-		players[0].velocity += blue_lance_direction * 3.0f;
+		players[0].velocity += blue_lance_direction / elapsed * LanceKnockback;
 		players[0].health -= 1;
 		std::cout<<"hit 1: "<<int(players[0].health)<<std::endl;
 		//bonus if the timing of the jab is good
 		if (players[1].since_attack > 0.25f && players[1].since_attack < 0.7f) players[0].health -= 1;
 	}
 	glm::vec3 red_lance_direction = lance_cur_pos[0] - lance_last_pos[0];
-	if (players[0].since_attack != 0.0f && !players[0].has_hit_this_attack && sphere_point_intersection(players[1].position, PlayerRadius, 
-		lance_cur_pos[0], players[1].position - hamster_last_pos[1], red_lance_direction, elapsed)) {
+	if (players[0].since_attack != 0.0f && !players[0].has_hit_this_attack && sphere_point_intersection(target_pos[1], PlayerRadius, 
+		lance_cur_pos[0], target_motion[1] / elapsed, red_lance_direction / elapsed, elapsed)) {
 		//player 1 got hit
 		players[0].has_hit_this_attack = true;
-		players[1].velocity += red_lance_direction * 3.0f;
+		players[1].velocity += red_lance_direction / elapsed * LanceKnockback;
 		players[1].health -= 1;
 		std::cout<<"hit 2: "<<int(players[1].health)<<std::endl;
 		//bonus if the timing of the jab is good
@@ -398,63 +458,443 @@ void Game::update(float elapsed) {
 	}
 }
 
+void Game::move_player(Player &p, Player::Command const &command) {
+	float elapsed = command.elapsed;
+
+	//rotating the hamster view using mouse
+	if (command.mouse_x != 0.0f) {
+		p.rotation = glm::normalize(
+			p.rotation
+			* glm::angleAxis(-command.mouse_x * 3.0f, glm::vec3(0.0f, 0.0f, 1.0f))
+		);
+	}
+
+	glm::vec3 dir = glm::vec3(0.0f);
+	if (command.down) dir.y += 1.0f;
+	if (command.up) dir.y -= 1.0f;
+	if (command.left) dir.x += 1.0f;
+	if (command.right) dir.x -= 1.0f;
+
+	dir = p.rotation * dir;
+
+	if (dir == glm::vec3(0.0f)) {
+		//no inputs: just drift to a stop
+		float amt = 1.0f - std::pow(0.5f, elapsed / (PlayerAccelHalflife * 2.0f));
+		p.velocity = glm::mix(p.velocity, glm::vec3(0.0f), amt);
+	} else {
+		//inputs: tween velocity to target direction
+		dir = glm::normalize(dir);
+
+		float amt = 1.0f - std::pow(0.5f, elapsed / PlayerAccelHalflife);
+
+		//accelerate along velocity (if not fast enough):
+		float along = glm::dot(p.velocity, dir);
+		if (along < PlayerSpeed) {
+			along = glm::mix(along, PlayerSpeed, amt);
+		}
+
+		//damp perpendicular velocity:
+		float perp = glm::dot(p.velocity, glm::vec3(-dir.y, dir.x, 0.0f));
+		perp = glm::mix(perp, 0.0f, amt);
+
+		p.velocity = dir * along + glm::vec3(-dir.y, dir.x, 0.0f) * perp;
+	}
+	p.position += p.velocity * elapsed;
+
+	// player/arena collisions:
+	if (p.position.x < ArenaMin.x + PlayerRadius) {
+		p.position.x = ArenaMin.x + PlayerRadius;
+		p.velocity.x = std::abs(p.velocity.x) * 0.5f;
+	}
+	if (p.position.x > ArenaMax.x - PlayerRadius) {
+		p.position.x = ArenaMax.x - PlayerRadius;
+		p.velocity.x =-std::abs(p.velocity.x) * 0.5f;
+	}
+	if (p.position.y < ArenaMin.y + PlayerRadius) {
+		p.position.y = ArenaMin.y + PlayerRadius;
+		p.velocity.y = std::abs(p.velocity.y) * 0.5f;
+	}
+	if (p.position.y > ArenaMax.y - PlayerRadius) {
+		p.position.y = ArenaMax.y - PlayerRadius;
+		p.velocity.y =-std::abs(p.velocity.y) * 0.5f;
+	}
+}
+
+void Game::queue_command(Player *player, Player::Command const &command) {
+	if (player == nullptr) return;
+	size_t index = size_t(player - &players[0]);
+	assert(index < commands.size());
+	//(commands arrive in order; anything not newer than what's been applied is stale)
+	if (command.seq <= last_command[index] || (!commands[index].empty() && command.seq <= commands[index].back().seq)) return;
+	if (commands[index].size() >= MaxQueuedCommands) return;
+	//a client far ahead of its movement budget is sending faster than real time:
+	float queued = command.elapsed;
+	for (Player::Command const &earlier : commands[index]) {
+		queued += earlier.elapsed;
+	}
+	if (queued > move_budget[index] + MaxQueuedTime) return;
+	commands[index].emplace_back(command);
+}
+
+void Game::set_view(Player *player, uint32_t acked_seq) {
+	if (player == nullptr) return;
+	size_t index = size_t(player - &players[0]);
+	assert(index < view_tick.size());
+	//remote hamsters are drawn InterpolationDelay behind the newest snapshot:
+	uint32_t delay = uint32_t(InterpolationDelay / tick_length() + 0.5f);
+	view_tick[index] = (acked_seq > delay ? acked_seq - delay : 0);
+}
+
+void Game::send_predicted_controls(Connection *connection, Player::Controls const &controls_, float elapsed) {
+	assert(player_type == RedHamster || player_type == BlueHamster);
+	Player::Command command = controls_.command(next_command_seq++, elapsed);
+	controls_.send_controls_message(connection, command.seq, elapsed);
+
+	Player &player = players[player_type];
+	move_player(player, command);
+	predicted.emplace_back(PredictedCommand{ command, player.position });
+}
+
+
+//-----------------------------------------
+//state snapshots:
+
+//the fields of a snapshot that are sent to clients, in wire order:
+// full state messages send every field; delta messages send a bitmask and then only the fields whose bit is set.
+struct StateField {
+	//how the field is encoded in StateFormat::Quantized messages:
+	enum Kind : uint8_t {
+		Plain, //as-is (same as StateFormat::Raw)
+		Rotation, //glm::quat, smallest-three: 2-bit index of the dropped (largest) component + 3 x 10-bit components
+		Position, //glm::vec3 in the arena, 16-bit fixed point per component
+		Offset, //glm::vec3 relative to a hamster, 16-bit fixed point per component
+		Velocity, //glm::vec3, half-precision floats
+	} kind;
+	void *data;
+	uint32_t size;
+};
+static constexpr uint32_t StateFieldCount = 3 + 2 * 9;
+static_assert(StateFieldCount <= 32, "changed-field mask is a uint32_t");
+
+static std::array< StateField, StateFieldCount > state_fields(Game::Snapshot &snapshot) {
+	std::array< StateField, StateFieldCount > fields;
+	uint32_t count = 0;
+	auto add = [&](StateField::Kind kind, auto &field) {
+		fields[count++] = StateField{ kind, &field, uint32_t(sizeof(field)) };
+	};
+
+	add(StateField::Plain, snapshot.tick_rate);
+	add(StateField::Plain, snapshot.player_ready);
+	add(StateField::Plain, snapshot.game_state);
+	for (auto &player : snapshot.players) {
+		add(StateField::Plain, player.dead);
+		add(StateField::Plain, player.health);
+		add(StateField::Plain, player.since_attack);
+		add(StateField::Rotation, player.rotation);
+		add(StateField::Rotation, player.lance_rotation);
+		add(StateField::Velocity, player.velocity);
+		add(StateField::Offset, player.lance_position);
+		add(StateField::Rotation, player.wheel_rotation);
+		add(StateField::Position, player.position);
+		//NOTE: can't just add(name) because player.name is not plain-old-data type.
+	}
+	assert(count == StateFieldCount);
+	return fields;
+}
+
+//---- quantized field encoding ----
+
+//fixed-point ranges: (values outside are clamped)
+// hamsters' x/y are kept inside the arena by Game::update(); their z and lance offsets only move a little:
+static constexpr float PositionZMin = -8.0f;
+static constexpr float PositionZMax = 8.0f;
+static constexpr float OffsetExtent = 8.0f;
+
+//smallest-three components of a unit quaternion lie in [-1/sqrt(2), 1/sqrt(2)]:
+static constexpr float RotationExtent = 0.70710678f;
+static constexpr uint32_t RotationBits = 10;
+static constexpr uint32_t RotationMax = (1u << RotationBits) - 1;
+
+//largest encoded field (a raw glm::quat):
+static constexpr uint32_t MaxFieldSize = sizeof(glm::quat);
+
+static uint32_t quantize(float value, float min, float max, uint32_t steps) {
+	float t = (std::clamp(value, min, max) - min) / (max - min);
+	return uint32_t(std::round(t * float(steps)));
+}
+static float dequantize(uint32_t code, float min, float max, uint32_t steps) {
+	return min + (max - min) * (float(code) / float(steps));
+}
+
+static void encode_fixed(glm::vec3 const &v, glm::vec3 const &min, glm::vec3 const &max, uint8_t *out) {
+	uint16_t codes[3];
+	for (uint32_t c = 0; c < 3; ++c) {
+		codes[c] = uint16_t(quantize(v[c], min[c], max[c], 0xffff));
+	}
+	std::memcpy(out, codes, sizeof(codes));
+}
+static void decode_fixed(uint8_t const *in, glm::vec3 const &min, glm::vec3 const &max, glm::vec3 *v) {
+	uint16_t codes[3];
+	std::memcpy(codes, in, sizeof(codes));
+	for (uint32_t c = 0; c < 3; ++c) {
+		(*v)[c] = dequantize(codes[c], min[c], max[c], 0xffff);
+	}
+}
+
+static glm::vec3 position_min() { return glm::vec3(Game::ArenaMin, PositionZMin); }
+static glm::vec3 position_max() { return glm::vec3(Game::ArenaMax, PositionZMax); }
+
+//bytes used by a field in a given format:
+static uint32_t encoded_size(StateField const &field, StateFormat format) {
+	if (format == StateFormat::Raw || field.kind == StateField::Plain) return field.size;
+	if (field.kind == StateField::Rotation) return 4;
+	return 3 * 2; //Position, Offset, Velocity
+}
+
+//write the encoded field to 'out' (which has room for MaxFieldSize bytes); returns the encoded size:
+static uint32_t encode_field(StateField const &field, StateFormat format, uint8_t *out) {
+	if (format == StateFormat::Raw || field.kind == StateField::Plain) {
+		std::memcpy(out, field.data, field.size);
+	} else if (field.kind == StateField::Rotation) {
+		glm::quat q = glm::normalize(*reinterpret_cast< glm::quat const * >(field.data));
+		float c[4] = {q.x, q.y, q.z, q.w};
+		//drop the largest component (recovered from |q| = 1), flipping q so that it's positive:
+		uint32_t largest = 0;
+		for (uint32_t i = 1; i < 4; ++i) {
+			if (std::abs(c[i]) > std::abs(c[largest])) largest = i;
+		}
+		float sign = (c[largest] < 0.0f ? -1.0f : 1.0f);
+		uint32_t bits = largest;
+		for (uint32_t i = 0; i < 4; ++i) {
+			if (i == largest) continue;
+			bits = (bits << RotationBits) | quantize(sign * c[i], -RotationExtent, RotationExtent, RotationMax);
+		}
+		std::memcpy(out, &bits, sizeof(bits));
+	} else if (field.kind == StateField::Position) {
+		encode_fixed(*reinterpret_cast< glm::vec3 const * >(field.data), position_min(), position_max(), out);
+	} else if (field.kind == StateField::Offset) {
+		encode_fixed(*reinterpret_cast< glm::vec3 const * >(field.data), glm::vec3(-OffsetExtent), glm::vec3(OffsetExtent), out);
+	} else { assert(field.kind == StateField::Velocity);
+		glm::vec3 const &v = *reinterpret_cast< glm::vec3 const * >(field.data);
+		uint16_t halves[3] = { glm::packHalf1x16(v.x), glm::packHalf1x16(v.y), glm::packHalf1x16(v.z) };
+		std::memcpy(out, halves, sizeof(halves));
+	}
+	return encoded_size(field, format);
+}
+
+//read an encoded field (of encoded_size() bytes) from 'in' into the field:
+static void decode_field(uint8_t const *in, StateFormat format, StateField const &field) {
+	if (format == StateFormat::Raw || field.kind == StateField::Plain) {
+		std::memcpy(field.data, in, field.size);
+	} else if (field.kind == StateField::Rotation) {
+		uint32_t bits;
+		std::memcpy(&bits, in, sizeof(bits));
+		uint32_t largest = bits >> (3 * RotationBits);
+		float c[4];
+		float sum2 = 0.0f;
+		for (uint32_t i = 4; i-- > 0; ) {
+			if (i == largest) continue;
+			c[i] = dequantize(bits & RotationMax, -RotationExtent, RotationExtent, RotationMax);
+			bits >>= RotationBits;
+			sum2 += c[i] * c[i];
+		}
+		c[largest] = std::sqrt(std::max(0.0f, 1.0f - sum2));
+		*reinterpret_cast< glm::quat * >(field.data) = glm::normalize(glm::quat(c[3], c[0], c[1], c[2]));
+	} else if (field.kind == StateField::Position) {
+		decode_fixed(in, position_min(), position_max(), reinterpret_cast< glm::vec3 * >(field.data));
+	} else if (field.kind == StateField::Offset) {
+		decode_fixed(in, glm::vec3(-OffsetExtent), glm::vec3(OffsetExtent), reinterpret_cast< glm::vec3 * >(field.data));
+	} else { assert(field.kind == StateField::Velocity);
+		uint16_t halves[3];
+		std::memcpy(halves, in, sizeof(halves));
+		*reinterpret_cast< glm::vec3 * >(field.data) = glm::vec3(glm::unpackHalf1x16(halves[0]), glm::unpackHalf1x16(halves[1]), glm::unpackHalf1x16(halves[2]));
+	}
+}
+
+Game::Snapshot Game::make_snapshot() const {
+	Snapshot snapshot;
+	snapshot.seq = tick;
+	snapshot.tick_rate = tick_rate;
+	snapshot.player_ready[0] = player_ready[0];
+	snapshot.player_ready[1] = player_ready[1];
+	snapshot.game_state = game_state;
+	snapshot.players = players;
+	return snapshot;
+}
+
+void Game::apply_snapshot(Snapshot const &snapshot_) {
+	//copy only the sent fields, so local-only player data (e.g., controls) is left alone:
+	Snapshot snapshot = snapshot_;
+	Snapshot merged = make_snapshot();
+	auto from = state_fields(snapshot);
+	auto to = state_fields(merged);
+	for (uint32_t f = 0; f < StateFieldCount; ++f) {
+		std::memcpy(to[f].data, from[f].data, to[f].size);
+	}
+
+	tick_rate = merged.tick_rate;
+	player_ready[0] = merged.player_ready[0];
+	player_ready[1] = merged.player_ready[1];
+	game_state = merged.game_state;
+	players = merged.players;
+}
+
+void Game::send_state_message(Connection *connection, Player *connection_player, StateHistory *history) const {
+	StateBroadcast(*this).send_state_message(connection, connection_player, history);
+}
+
+Game::StateBroadcast::StateBroadcast(Game const &game_) : game(game_) {
+}
+
+Game::StateBroadcast::Encoding const &Game::StateBroadcast::encoding(StateFormat format) {
+	Encoding &encoding = encodings.at(size_t(format));
+	if (encoding.snapshot) return encoding;
+
+	//encode every field into the body of a full snapshot:
+	// (quantized fields are decoded again, so 'snapshot' -- and the histories -- hold exactly what clients will have)
+	auto snapshot = std::make_shared< Snapshot >(game.make_snapshot());
+	auto fields = state_fields(*snapshot);
+
+	auto bytes = std::make_shared< std::vector< uint8_t > >();
+	bytes->reserve(sizeof(format) + sizeof(snapshot->seq) + StateFieldCount * MaxFieldSize);
+	auto append = [&](void const *data, size_t size) {
+		bytes->insert(bytes->end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+	};
+	append(&format, sizeof(format));
+	append(&snapshot->seq, sizeof(snapshot->seq));
+
+	encoding.field_offsets.clear();
+	for (auto const &field : fields) {
+		std::array< uint8_t, MaxFieldSize > encoded;
+		uint32_t size = encode_field(field, format, encoded.data());
+		if (format != StateFormat::Raw) decode_field(encoded.data(), format, field);
+		encoding.field_offsets.emplace_back(uint32_t(bytes->size()));
+		append(encoded.data(), size);
+	}
+	encoding.field_offsets.emplace_back(uint32_t(bytes->size()));
 
-void Game::send_state_message(Connection *connection_, Player *connection_player) const {
+	encoding.full.type = Message::S2C_State;
+	encoding.full.bytes = std::move(bytes);
+	encoding.snapshot = std::move(snapshot);
+	return encoding;
+}
+
+Game::StateBroadcast::Body const &Game::StateBroadcast::delta(StateFormat format, Snapshot const &base) {
+	auto found = deltas.find(std::make_pair(format, base.seq));
+	if (found != deltas.end()) return found->second;
+
+	Encoding const &current = encoding(format);
+	//(fields are only read here)
+	auto current_fields = state_fields(const_cast< Snapshot & >(*current.snapshot));
+	auto base_fields = state_fields(const_cast< Snapshot & >(base));
+
+	uint32_t changed = 0;
+	for (uint32_t f = 0; f < StateFieldCount; ++f) {
+		if (std::memcmp(current_fields[f].data, base_fields[f].data, current_fields[f].size) != 0) {
+			changed |= (1u << f);
+		}
+	}
+
+	auto bytes = std::make_shared< std::vector< uint8_t > >();
+	auto append = [&](void const *data, size_t size) {
+		bytes->insert(bytes->end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+	};
+	append(&format, sizeof(format));
+	append(&current.snapshot->seq, sizeof(current.snapshot->seq));
+	append(&base.seq, sizeof(base.seq));
+	append(&changed, sizeof(changed));
+	for (uint32_t f = 0; f < StateFieldCount; ++f) {
+		if (changed & (1u << f)) {
+			append(current.full.bytes->data() + current.field_offsets[f], current.field_offsets[f + 1] - current.field_offsets[f]);
+		}
+	}
+
+	Body &body = deltas[std::make_pair(format, base.seq)];
+	body.type = Message::S2C_StateDelta;
+	body.bytes = std::move(bytes);
+	return body;
+}
+
+void Game::StateBroadcast::send_state_message(Connection *connection_, Player *connection_player, StateHistory *history) {
 	assert(connection_);
 	auto &connection = *connection_;
 
-	connection.send(Message::S2C_State);
-	//will patch message size in later, for now placeholder bytes:
-	connection.send(uint8_t(0));
-	connection.send(uint8_t(0));
-	connection.send(uint8_t(0));
-	size_t mark = connection.send_buffer.size(); //keep track of this position in the buffer
-
-
-	//send player info helper:
-	auto send_player = [&](Player const &player) {
-
-		connection.send(player.dead);
-		connection.send(player.health);
-		connection.send(player.since_attack);
-		connection.send(player.rotation);
-		connection.send(player.lance_rotation);
-		connection.send(player.velocity);
-		connection.send(player.lance_position);
-		connection.send(player.wheel_rotation);
-		connection.send(player.position);
-	
-		//NOTE: can't just 'send(name)' because player.name is not plain-old-data type.
-		//effectively: truncates player name to 255 chars
-		// uint8_t len = uint8_t(std::min< size_t >(255, player.name.size()));
-		// connection.send(len);
-		// connection.send_buffer.insert(connection.send_buffer.end(), player.name.begin(), player.name.begin() + len);
-	};
+	//state is droppable (the next tick's state replaces it), so don't add to a backed-up send_buffer:
+	if (connection.send_high_water != 0 && connection.send_buffer.size() >= connection.send_high_water) {
+		dropped += 1;
+		if (history) history->dropped += 1;
+		return;
+	}
+
+	StateFormat format = (history ? history->format : StateFormat::Raw);
+	Encoding const &current = encoding(format);
 
-	//number of ready players
-	connection.send(player_ready);
-	connection.send(game_state);
 	// whether this player is red or blue hamster
+	PlayerType type = PlayerType::Spectator;
+	uint32_t command = 0; //latest of the client's movement commands applied (0 => none)
 	if (connection_player != nullptr) {
-		connection.send(static_cast<PlayerType>(connection_player != &players[0]));
+		type = static_cast<PlayerType>(connection_player != &game.players[0]);
+		command = game.last_command[type];
 	}
-	else {
-		connection.send(PlayerType::Spectator);
+
+	//send changes from the acknowledged snapshot if the client is still guaranteed to have it:
+	Body const *body = &current.full;
+	if (history && history->acked && current.snapshot->seq - history->acked->seq <= MaxDeltaAge) {
+		body = &delta(format, *history->acked);
+	}
+
+	//per-connection prefix (header, role, and applied command) followed by the shared body:
+	uint8_t prefix[MessageView::HeaderSize + sizeof(type) + sizeof(command)];
+	MessageView::write_header(prefix, body->type, uint32_t(sizeof(type) + sizeof(command) + body->bytes->size()));
+	std::memcpy(prefix + MessageView::HeaderSize, &type, sizeof(type));
+	std::memcpy(prefix + MessageView::HeaderSize + sizeof(type), &command, sizeof(command));
+	uint32_t replaced = connection.send_shared(prefix, sizeof(prefix), body->bytes, replace_queued ? StateSegmentTag : 0);
+	dropped += replaced;
+	if (history) history->dropped += replaced;
+
+	if (history) {
+		history->unacked.emplace_back(current.snapshot);
+		//acks for snapshots this old would be too old to send deltas from anyway:
+		while (history->unacked.size() > MaxDeltaAge) {
+			history->unacked.pop_front();
+		}
 	}
-	for (auto const &player : players) {
-		send_player(player);
+}
+
+void Game::StateHistory::recv_ack_message(MessageView const &message) {
+	assert(message.type == uint8_t(Message::C2S_StateAck));
+
+	MessageView::Reader reader = message.reader();
+	uint32_t seq = reader.read< uint32_t >();
+	reader.finish();
+
+	if (seq == 0) {
+		//client lost track of its snapshots; start over with a full snapshot:
+		acked.reset();
+		unacked.clear();
+		return;
+	}
+
+	//find the acknowledged snapshot; everything sent before it is no longer needed:
+	// (acks for snapshots already dropped from the history are ignored)
+	while (!unacked.empty() && unacked.front()->seq <= seq) {
+		if (unacked.front()->seq == seq) {
+			acked = unacked.front();
+		}
+		unacked.pop_front();
 	}
+}
+
+void Game::send_state_ack_message(Connection *connection_, uint32_t seq) const {
+	assert(connection_);
+	auto &connection = *connection_;
 
-	//compute the message size and patch into the message header:
-	uint32_t size = uint32_t(connection.send_buffer.size() - mark);
-	connection.send_buffer[mark-3] = uint8_t(size);
-	connection.send_buffer[mark-2] = uint8_t(size >> 8);
-	connection.send_buffer[mark-1] = uint8_t(size >> 16);
+	MessageView::send_header(&connection, Message::C2S_StateAck, sizeof(seq));
+	connection.send(seq);
 }
 
 void Game::reset_hamsters()
 {
-	static bool initialized = false;
 	if (!initialized) {
 		Player &red_hamster = initial_player_state[0];
 		red_hamster.dead = false;
@@ -472,35 +912,17 @@ void Game::reset_hamsters()
 		blue_hamster.since_attack = 0.0f;
 		blue_hamster.position = {1.0f, 22.0f, 2.35f};
 
-		for (auto &transform : main_scene_server.transforms) {
+		//(the rest of the initial state is how the arena scene has the hamsters posed)
+		red_hamster.rotation = hamster_red.hamster_transform->rotation;
+		red_hamster.lance_rotation = hamster_red.lance_transform->rotation;
+		red_hamster.lance_position = hamster_red.lance_transform->position;
+		red_hamster.wheel_rotation = hamster_red.wheel_transform->rotation;
+
+		blue_hamster.rotation = hamster_blue.hamster_transform->rotation;
+		blue_hamster.lance_rotation = hamster_blue.lance_transform->rotation;
+		blue_hamster.lance_position = hamster_blue.lance_transform->position;
+		blue_hamster.wheel_rotation = hamster_blue.wheel_transform->rotation;
 
-			if (transform.name == "RedHamster") {
-				red_hamster.rotation = transform.rotation;
-			}
-			else if (transform.name == "BlueHamster") {
-				blue_hamster.rotation = transform.rotation;
-			}
-			else if (transform.name == "RedLance") {
-				red_hamster.lance_rotation = transform.rotation;
-				red_hamster.lance_position = transform.position;
-			}
-			else if (transform.name == "BlueLance") {
-				blue_hamster.lance_rotation = transform.rotation;
-				blue_hamster.lance_position = transform.position;
-			}
-			else if (transform.name == "RedWheel") {
-				red_hamster.wheel_rotation = transform.rotation;
-			}
-			else if (transform.name == "BlueWheel") {
-				blue_hamster.wheel_rotation = transform.rotation;
-			}
-			else if (transform.name == "RedLancePoint") {
-				lance_tip_transform[0] = &transform;
-			}
-			else if (transform.name == "BlueLancePoint") {
-				lance_tip_transform[1] = &transform;
-			}
-		}
 		initialized = true;
 	}
 	players[0] = initial_player_state[0];
@@ -528,37 +950,30 @@ void Game::reset_game()
 	next_player_number = 0;
 }
 
-void Game::send_handshake_message(Connection *connection_) const
+void Game::send_handshake_message(Connection *connection_, bool ready) const
 {
-	if (game_state != WaitingForPlayer) return;
-	if (player_type != Spectator) return;
+	if (ready && game_state != WaitingForPlayer) return;
+	if (ready && player_type != Spectator) return;
 	assert(connection_);
 	auto &connection = *connection_;
-	connection.send(uint8_t(Message::C2S_Handshake));
-	connection.send(uint8_t(1));
-	connection.send(true);
+	MessageView::send_header(&connection, Message::C2S_Handshake, sizeof(ready) + sizeof(state_format));
+	connection.send(ready);
+	connection.send(state_format);
 }
 
-bool Game::recv_handshake_message(Connection *connection_)
+void Game::recv_handshake_message(MessageView const &message, bool *ready, StateFormat *format)
 {
-	if (game_state != WaitingForPlayer) return false;
-	assert(connection_);
-	auto &connection = *connection_;
-
-	auto &recv_buffer = connection.recv_buffer;
-
-	//expecting [type, 1, true]:
-	if (recv_buffer.size() < 3) return false;
-	std::cout<<recv_buffer[0]<<std::endl;
-	if (recv_buffer[0] != uint8_t(Message::C2S_Handshake)) return false;
-	std::cout<<"handshake 3\n"<<std::endl;
-	if (uint32_t(recv_buffer[1]) != 1 || !bool(recv_buffer[2])) throw std::runtime_error("Handshake message not in expected format!");
-
-	//clear the entire buffer
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.end());
-	std::cout<<"success on handshake\n"<<std::endl;
-
-	return true;
+	assert(message.type == uint8_t(Message::C2S_Handshake));
+	assert(ready && format);
+
+	//expecting [ready][format]:
+	MessageView::Reader reader = message.reader();
+	*ready = reader.read< bool >();
+	*format = reader.read< StateFormat >();
+	if (*format != StateFormat::Raw && *format != StateFormat::Quantized) {
+		throw std::runtime_error("Handshake message asks for unknown state format " + std::to_string(int(*format)) + ".");
+	}
+	reader.finish();
 }
 
 
@@ -595,59 +1010,79 @@ bool Game::sphere_point_intersection(const glm::vec3 &sphere_position, float sph
 	return collide_t <= elapsed;
 }
 
-bool Game::recv_state_message(Connection *connection_)
+bool Game::recv_state_message(MessageView const &message)
 {
-    assert(connection_);
-	auto &connection = *connection_;
-	auto &recv_buffer = connection.recv_buffer;
-
-	if (recv_buffer.size() < 4) return false;
-	if (recv_buffer[0] != uint8_t(Message::S2C_State)) return false;
-	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
-	              | (uint32_t(recv_buffer[2]) << 8)
-	              |  uint32_t(recv_buffer[1]);
-	uint32_t at = 0;
-	//expecting complete message:
-	if (recv_buffer.size() < 4 + size) return false;
-
-	//copy bytes from buffer and advance position:
-	auto read = [&](auto *val) {
-		if (at + sizeof(*val) > size) {
-			throw std::runtime_error("Ran out of bytes reading state message.");
-		}
-		std::memcpy(val, &recv_buffer[4 + at], sizeof(*val));
-		at += sizeof(*val);
+	assert(message.type == uint8_t(Message::S2C_State) || message.type == uint8_t(Message::S2C_StateDelta));
+
+	//copy fields straight out of the message payload:
+	MessageView::Reader reader = message.reader();
+
+	PlayerType type = reader.read< PlayerType >();
+	uint32_t command = reader.read< uint32_t >();
+	StateFormat format = reader.read< StateFormat >();
+	if (format != StateFormat::Raw && format != StateFormat::Quantized) {
+		throw std::runtime_error("Unknown state format " + std::to_string(int(format)) + ".");
+	}
+	Snapshot snapshot;
+	reader.read(&snapshot.seq);
+	auto fields = state_fields(snapshot);
+
+	auto read_field = [&](StateField const &field) {
+		std::array< uint8_t, MaxFieldSize > encoded;
+		uint32_t size = encoded_size(field, format);
+		reader.read_raw(encoded.data(), size);
+		decode_field(encoded.data(), format, field);
 	};
 
-	read(&player_ready);
-	read(&game_state);
-	read(&player_type);
-	for (uint8_t i = 0; i < 2; ++i) {
-		Player &player = players[i];
-		read(&player.dead);
-		read(&player.health);
-		read(&player.since_attack);
-		read(&player.rotation);
-		read(&player.lance_rotation);
-		read(&player.velocity);
-		read(&player.lance_position);
-		read(&player.wheel_rotation);
-		read(&player.position);
-		// uint8_t name_len;
-		// read(&name_len);
-		//n.b. would probably be more efficient to directly copy from recv_buffer, but I think this is clearer:
-		// player.name = "";
-		// for (uint8_t n = 0; n < name_len; ++n) {
-		// 	char c;
-		// 	read(&c);
-		// 	player.name += c;
-		// }
-	}
-	assert(at==size);
-	if (at != size) throw std::runtime_error("Trailing data in state message.");
-
-	//delete message from buffer:
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	if (message.type == uint8_t(Message::S2C_State)) {
+		for (auto const &field : fields) {
+			read_field(field);
+		}
+	} else {
+		uint32_t base_seq = reader.read< uint32_t >();
+		uint32_t changed = reader.read< uint32_t >();
+		if (changed >> StateFieldCount) throw std::runtime_error("State delta message marks unknown fields as changed.");
+
+		//start from the baseline snapshot, if it is still around:
+		auto base = std::find_if(received_snapshots.begin(), received_snapshots.end(), [&](Snapshot const &s) { return s.seq == base_seq; });
+		if (base == received_snapshots.end()) return false;
+		uint32_t seq = snapshot.seq;
+		snapshot = *base;
+		snapshot.seq = seq;
+
+		for (uint32_t f = 0; f < StateFieldCount; ++f) {
+			if (changed & (1u << f)) read_field(fields[f]);
+		}
+	}
+	reader.finish();
+
+	player_type = type;
+	acked_command = command;
+	apply_snapshot(snapshot);
+
+	received_snapshots.emplace_back(snapshot);
+	//server only sends deltas from snapshots up to MaxDeltaAge ticks old; keep a few extra in case acks are slow:
+	while (received_snapshots.size() > 2 * MaxDeltaAge) {
+		received_snapshots.pop_front();
+	}
+
+	//client-side prediction: the server's state already includes commands up to 'acked_command'; re-apply the rest:
+	// (commands are only sent, and applied, while playing)
+	if ((player_type != RedHamster && player_type != BlueHamster) || game_state != GameState::InGame) {
+		predicted.clear();
+		return true;
+	}
+	Player &player = players[player_type];
+	while (!predicted.empty() && predicted.front().command.seq <= acked_command) {
+		if (predicted.front().command.seq == acked_command) {
+			prediction_error = glm::length(predicted.front().position - player.position);
+		}
+		predicted.pop_front();
+	}
+	for (auto &p : predicted) {
+		move_player(player, p.command);
+		p.position = player.position;
+	}
 
 	return true;
-}
\ No newline at end of file
+}
@@ -8,9 +8,14 @@
 #include <string>
 #include <list>
 #include <array>
+#include <deque>
+#include <map>
+#include <memory>
 #include <random>
+#include <vector>
 
 struct Connection;
+struct MessageView;
 
 //Game state, separate from rendering.
 
@@ -19,7 +24,9 @@ struct Connection;
 enum class Message : uint8_t {
 	C2S_Controls = 1, //Greg!
 	C2S_Handshake = 2, //Get the player role
-	S2C_State = 's',
+	C2S_StateAck = 3, //latest state snapshot received (0 => please send a full snapshot)
+	S2C_State = 's', //full state snapshot
+	S2C_StateDelta = 'd', //state snapshot as changes from a snapshot the client acknowledged
 	//...
 };
 
@@ -36,20 +43,46 @@ enum PlayerType : uint8_t {
 	Uninitialized = 3,
 };
 
+//how state snapshots are encoded on the wire (requested by each client in its C2S_Handshake):
+enum class StateFormat : uint8_t {
+	Raw = 0, //32-bit floats, as stored
+	Quantized = 1, //smallest-three quaternions, fixed-point positions, half-precision velocities
+};
+
 //state of one player in the game:
 struct Player {
+	//movement input for one client frame, applied in order (by Game::move_player) on the server and,
+	// to predict the local player's movement without waiting for the server, on the client that sent it:
+	struct Command {
+		uint32_t seq = 0; //increases by one with each command a client sends
+		float elapsed = 0.0f; //length of the frame (at most MaxElapsed)
+		bool left = false, right = false, up = false, down = false;
+		float mouse_x = 0.0f;
+
+		//longer frames (e.g., hitches) are applied as this long:
+		inline static constexpr float MaxElapsed = 0.1f;
+	};
+
 	//player inputs (sent from client):
 	struct Controls {
 		Button left, right, up, down, jump, LMB;
 
 		float mouse_x = 0.0f;
 
-		void send_controls_message(Connection *connection) const;
+		//movement input (sequence number 'seq') for a frame of length 'elapsed':
+		Command command(uint32_t seq, float elapsed) const;
+
+		//send controls, along with the frame's movement command:
+		void send_controls_message(Connection *connection, uint32_t seq, float elapsed) const;
 
-		//returns 'false' if no message or not a controls message,
-		//returns 'true' if read a controls message,
+		//read a (C2S_Controls) message in place, adding its button presses to these controls,
+		// returns the movement command it carried
 		//throws on malformed controls message
-		bool recv_controls_message(Connection *connection);
+		Command recv_controls_message(MessageView const &message);
+
+		//add controls read (with recv_controls_message) into a separate Controls, e.g. on another thread:
+		// (button presses are added up; everything else is replaced)
+		void add(Controls const &received);
 	} controls;
 
 	//player state (sent from server):
@@ -66,6 +99,11 @@ struct Player {
 
 	float cur_lance_angle = 0.0f;
 
+	//animation state (server only, not sent):
+	float lance_sweep = 1.0f; //direction cur_lance_angle moves while 'jump' is held
+	float wheel_spin = 0.0f; //wheel angle from rolling
+	float wheel_steer = 0.0f; //wheel angle from steering (smoothed)
+
 	Player() = default;
 };
 
@@ -99,23 +137,94 @@ struct Game {
 		Ended,
 	} game_state = GameState::WaitingForPlayer;
 
-	void send_handshake_message(Connection *connection) const;
+	//used by client: state format to ask the server for
+	StateFormat state_format = StateFormat::Quantized;
+
+	//used by client:
+	//send the state format to use and whether this client wants to play
+	// (sent with 'ready = false' on connect; 'ready = true' is only sent by spectators while waiting for players)
+	void send_handshake_message(Connection *connection, bool ready) const;
 
-	bool recv_handshake_message(Connection *connection);
+	//read a (C2S_Handshake) message in place,
+	//throws on malformed handshake message
+	static void recv_handshake_message(MessageView const &message, bool *ready, StateFormat *format);
 
 	Game();
+	//(hamster and lance tip transforms point into main_scene_server, so games stay put:)
+	Game(Game const &) = delete;
+	Game &operator=(Game const &) = delete;
 
 	//state update function:
+	// (runs one or more fixed steps; see SimStep)
 	void update(float elapsed);
+	//advance by one step, applying the first due[i] of commands[i] to each player
+	// ('tick_from' and 'tick_to' are where the step starts and ends, as fractions of the tick):
+	void step(float elapsed, std::array< size_t, 2 > const &due, float tick_from, float tick_to);
+
+	//apply one movement command to a player (steering, acceleration, and arena walls):
+	// (only touches 'player', so clients can run it to predict their own hamster)
+	static void move_player(Player &player, Player::Command const &command);
+
+	//used by server:
+	//movement commands received for each player, applied in order by the next update():
+	std::array< std::deque< Player::Command >, 2 > commands;
+	//seq of the latest command update() applied (or dropped) for each player (sent with state, so clients know what to re-apply):
+	std::array< uint32_t, 2 > last_command = {0, 0};
+	//movement time each player's commands may still use (time update() has simulated that their commands haven't covered):
+	// commands that don't fit wait for a later update, so sending more (or longer) commands doesn't move a hamster faster.
+	// Up to MoveSlack is kept for commands held up on the way; past that, the server moves the hamster itself, with no input.
+	std::array< float, 2 > move_budget = {0.0f, 0.0f};
+	//queue a command (from recv_controls_message) for 'player' (nullptr => spectator, ignored):
+	// (refused past MaxQueuedCommands, or if the player's queued commands would add up to more than MaxQueuedTime past its budget)
+	void queue_command(Player *player, Player::Command const &command);
+
+	//used by server: lag compensation for lance hits
+	// an attacker's lance is tested against where the attacker's client was drawing the other hamster
+	// (InterpolationDelay behind the latest snapshot it acknowledged), rewound at most 'max_rewind' seconds:
+	float max_rewind = 0.25f;
+	std::array< uint32_t, 2 > view_tick = {0, 0}; //per player: the tick its client is showing (0 => unknown, no rewind)
+	//set a player's view_tick from the seq of the latest snapshot its client acknowledged (0 => none):
+	void set_view(Player *player, uint32_t acked_seq);
+	//hamster positions at the end of recent ticks, in a ring indexed by tick:
+	struct PastTick {
+		uint32_t tick = 0; //(0 => not recorded)
+		std::array< glm::vec3, 2 > position;
+	};
+	std::array< PastTick, 64 > past_ticks; //(enough for max_rewind at 120Hz)
 
 	// game scene
 	Scene main_scene_server;
 
 	Scene::Transform *lance_tip_transform[2] = {nullptr, nullptr};
+	bool initialized = false; //initial_player_state has been read from main_scene_server
+
+	//number of calls to update(); used to sequence state snapshots:
+	// (a server hosting several games may start this from its own tick count, so snapshot seqs never repeat across games)
+	uint32_t tick = 0;
+
+	//updates per second on the server (set by the server; clients learn it from state messages):
+	uint8_t tick_rate = TickRate;
+	//seconds per update:
+	float tick_length() const { return 1.0f / float(tick_rate); }
 
 	//constants:
-	//the update rate on the server:
-	inline static constexpr float Tick = 1.0f / 30.0f;
+	//the default update rate on the server:
+	inline static constexpr uint8_t TickRate = 30;
+	inline static constexpr float Tick = 1.0f / float(TickRate);
+	//the length of one simulation step (ticks are split into steps of about this length):
+	inline static constexpr float SimStep = 1.0f / 120.0f;
+
+	//movement budget a player can bank for late commands (see move_budget), which is also as far behind
+	// as its queued commands may fall before the oldest are dropped:
+	inline static constexpr float MoveSlack = 0.15f;
+	static_assert(MoveSlack >= Player::Command::MaxElapsed, "the longest command must fit in the budget");
+	//movement time past its budget a player's queued commands can add up to:
+	inline static constexpr float MaxQueuedTime = 0.25f;
+	//commands that can be queued for a player:
+	inline static constexpr size_t MaxQueuedCommands = 256;
+
+	//how far behind the newest state clients draw other hamsters (see PlayMode):
+	inline static constexpr float InterpolationDelay = 0.1f;
 
 	//arena size:
 	inline static constexpr glm::vec2 ArenaMin = glm::vec2(-22.5f, -22.5f);
@@ -125,6 +234,8 @@ struct Game {
 	inline static constexpr float PlayerRadius = 1.1f;
 	inline static constexpr float PlayerSpeed = 20.0f;
 	inline static constexpr float PlayerAccelHalflife = 1.0f;
+	//a hit hamster gains the lance tip's velocity times this (seconds):
+	inline static constexpr float LanceKnockback = 0.1f;
 
 	//---- game state helpers ----
 	void reset_hamsters();
@@ -139,15 +250,117 @@ struct Game {
 		const float elapsed
 	);
 
+	//---- state snapshots ----
+
+	//the part of the game state that is sent to clients:
+	struct Snapshot {
+		uint32_t seq = 0; //the tick the snapshot was taken on (0 => no snapshot)
+		uint8_t tick_rate = TickRate;
+		bool player_ready[2] = {false, false};
+		GameState game_state = GameState::WaitingForPlayer;
+		std::array< Player, 2 > players;
+	};
+	Snapshot make_snapshot() const;
+	void apply_snapshot(Snapshot const &snapshot);
+
+	//used by server, per connection:
+	//snapshots sent to / acknowledged by a client, so state can be sent as changes from the acknowledged one:
+	// (snapshots are shared between every connection they were sent to)
+	struct StateHistory {
+		StateFormat format = StateFormat::Raw; //format the client asked for
+		std::shared_ptr< Snapshot const > acked; //latest snapshot the client acknowledged (nullptr => none, send full snapshots)
+		std::deque< std::shared_ptr< Snapshot const > > unacked; //snapshots sent after 'acked', oldest first
+		uint32_t dropped = 0; //state messages never sent because the client's send_buffer was backed up
+
+		//read a (C2S_StateAck) message and move 'acked' forward (or reset it if the client asks for a full snapshot)
+		//throws on malformed ack message
+		void recv_ack_message(MessageView const &message);
+	};
+
+	//deltas are only sent against snapshots at most this many ticks old:
+	// (clients keep at least this many received snapshots around to decode them)
+	inline static constexpr uint32_t MaxDeltaAge = 32;
+
+	//used by client:
+	//recently received snapshots (newest last), kept as baselines for decoding deltas:
+	std::deque< Snapshot > received_snapshots;
+
+	//---- client-side prediction ----
+
+	//used by client:
+	//the local player moves as soon as each command is sent; when state arrives, the commands the server
+	// hadn't applied yet are applied again on top of it (so inputs don't wait a round trip to show up).
+	struct PredictedCommand {
+		Player::Command command;
+		glm::vec3 position; //predicted position after the command
+	};
+	std::deque< PredictedCommand > predicted; //commands sent but not yet applied by the server, oldest first
+	uint32_t next_command_seq = 1;
+	uint32_t acked_command = 0; //latest command the server had applied to the local player (from the latest state message)
+	float prediction_error = 0.0f; //distance between predicted and server position after 'acked_command'
+
+	//used by client:
+	//send 'controls' for a frame of length 'elapsed' and apply its movement to the local player:
+	void send_predicted_controls(Connection *connection, Player::Controls const &controls, float elapsed);
+
 	//---- communication helpers ----
 
 	//used by client:
-	//set game state from data in connection buffer
-	// (return true if data was read)
-	bool recv_state_message(Connection *connection);
+	//set game state from a (S2C_State or S2C_StateDelta) message, then re-apply unacknowledged predicted commands
+	// returns 'false' (leaving state alone) if it was a delta from a snapshot this client no longer has
+	//throws on malformed state message
+	bool recv_state_message(MessageView const &message);
+
+	//used by client:
+	//acknowledge the snapshot with sequence number 'seq' (pass 0 to request a full snapshot)
+	void send_state_ack_message(Connection *connection, uint32_t seq) const;
 
 	//used by server:
 	//send game state.
-	//  Will move "connection_player" to the front of the front of the sent list.
-	void send_state_message(Connection *connection, Player *connection_player = nullptr) const;
+	//  "connection_player" is used to tell the client which hamster (if any) it is controlling.
+	//  if "history" is given, sends only changes from the last snapshot the client acknowledged (when possible)
+	//  and records the sent snapshot in the history.
+	void send_state_message(Connection *connection, Player *connection_player = nullptr, StateHistory *history = nullptr) const;
+
+	//used by server:
+	//game state for one tick, encoded once and shared by every connection it is sent to:
+	// message bodies (everything after the role and applied command) are encoded once per format (full snapshots)
+	// or once per format and baseline (deltas), so sending to another connection costs a five-byte prefix and a copy.
+	//NOTE: encodes the game's state lazily, so don't change the game while a broadcast is in use.
+	struct StateBroadcast {
+		StateBroadcast(Game const &game);
+
+		//same as Game::send_state_message:
+		void send_state_message(Connection *connection, Player *connection_player = nullptr, StateHistory *history = nullptr);
+
+		//if set, a state message replaces any earlier one still waiting (unsent) in the connection's send_buffer,
+		// so clients that can't keep up get the newest state instead of a growing backlog of old ones:
+		// (safe because deltas are always from a snapshot the client acknowledged, never from the previous message)
+		bool replace_queued = true;
+		inline static constexpr uint8_t StateSegmentTag = uint8_t(Message::S2C_State); //Connection::SendQueue segment tag
+
+		//state messages dropped by this broadcast, either replaced while queued or not queued at all because
+		// the connection's send_buffer was over its high water mark: (also counted in each StateHistory)
+		uint32_t dropped = 0;
+
+		//encoded message body:
+		struct Body {
+			Message type = Message::S2C_State;
+			std::shared_ptr< std::vector< uint8_t > const > bytes;
+		};
+
+		//internals:
+		Game const &game;
+
+		struct Encoding {
+			std::shared_ptr< Snapshot const > snapshot; //the snapshot as clients will decode it (nullptr => not encoded yet)
+			Body full;
+			std::vector< uint32_t > field_offsets; //where each field starts in full.bytes (plus one past the last field)
+		};
+		std::array< Encoding, 2 > encodings; //indexed by StateFormat
+		std::map< std::pair< StateFormat, uint32_t >, Body > deltas; //indexed by format and baseline seq
+
+		Encoding const &encoding(StateFormat format);
+		Body const &delta(StateFormat format, Snapshot const &base);
+	};
 };
@@ -0,0 +1,56 @@
+#pragma once
+
+/*
+ * Histogram counts durations (e.g., how long each server tick spent stepping matches) in
+ * logarithmic buckets, so percentiles can be reported without keeping every sample:
+
+	Histogram update_times;
+	update_times.add(seconds); //once per tick
+	//...every few seconds:
+	std::cout << update_times.percentile(0.99) * 1000.0 << "ms";
+	update_times.clear();
+
+ * Buckets are a quarter-octave wide starting at 1us, so a reported percentile is at most ~19% above the true one.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+struct Histogram {
+	static constexpr uint32_t BucketsPerOctave = 4;
+	static constexpr double Smallest = 1e-6; //seconds; bucket 0 holds everything shorter
+
+	//record one duration (in seconds):
+	void add(double seconds) {
+		uint32_t bucket = 0;
+		if (seconds >= Smallest) {
+			bucket = std::min(uint32_t(std::log2(seconds / Smallest) * BucketsPerOctave) + 1, uint32_t(counts.size()) - 1);
+		}
+		counts[bucket] += 1;
+		count += 1;
+		max = std::max(max, seconds);
+	}
+
+	//duration that 'fraction' (in [0,1]) of the samples are no longer than, rounded up to a bucket edge (0 => no samples):
+	double percentile(double fraction) const {
+		uint32_t rank = std::max(uint32_t(std::ceil(fraction * count)), uint32_t(1));
+		uint32_t seen = 0;
+		for (uint32_t b = 0; b < uint32_t(counts.size()); ++b) {
+			seen += counts[b];
+			if (seen >= rank) return std::min(Smallest * std::exp2(double(b) / BucketsPerOctave), max);
+		}
+		return max;
+	}
+
+	void clear() {
+		counts.fill(0);
+		count = 0;
+		max = 0.0;
+	}
+
+	std::array< uint32_t, 26 * BucketsPerOctave > counts{}; //(the last bucket holds everything over ~1 minute)
+	uint32_t count = 0;
+	double max = 0.0;
+};
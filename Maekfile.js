@@ -142,7 +142,9 @@ const client_names = [
 ];
 
 const server_names = [
-	maek.CPP('server.cpp')
+	maek.CPP('server.cpp'),
+	maek.CPP('ThreadPool.cpp'),
+	maek.CPP('Recording.cpp')
 ];
 
 const common_names = [
@@ -169,6 +171,25 @@ const show_meshes_names = [
 	maek.CPP('ShowMeshesMode.cpp')
 ];
 
+const bench_net_names = [
+	maek.CPP('bench-net.cpp'),
+	maek.CPP('ThreadPool.cpp'),
+	maek.CPP('Recording.cpp')
+];
+
+const bench_game_names = [
+	maek.CPP('bench-game.cpp')
+];
+
+const bench_scene_names = [
+	maek.CPP('bench-scene.cpp')
+];
+
+const replay_names = [
+	maek.CPP('replay.cpp'),
+	maek.CPP('Recording.cpp')
+];
+
 const show_scene_names = [
 	maek.CPP('show-scene.cpp'),
 	maek.CPP('ShowSceneProgram.cpp'),
@@ -184,6 +205,16 @@ const server_exe = maek.LINK([...server_names, ...common_names], 'dist/server');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
 
+//benchmarks aren't built by default; request them by name, e.g.:
+//  node Maekfile.js dist/bench-net
+const bench_net_exe = maek.LINK([...bench_net_names, ...common_names], 'dist/bench-net');
+const bench_game_exe = maek.LINK([...bench_game_names, ...common_names], 'dist/bench-game');
+const bench_scene_exe = maek.LINK([...bench_scene_names, ...common_names], 'dist/bench-scene');
+
+//replays of recorded matches (see Recording.hpp) are re-simulated with:
+//  node Maekfile.js dist/replay
+const replay_exe = maek.LINK([...replay_names, ...common_names], 'dist/replay');
+
 //set the default target to the game (and copy the readme files):
 maek.TARGETS = [client_exe, server_exe, show_meshes_exe, show_scene_exe, ...copies];
 
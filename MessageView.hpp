@@ -0,0 +1,135 @@
+#pragma once
+
+/*
+ * MessageView frames the messages queued in a Connection's recv_buffer in place.
+ *
+ * Messages are framed as:
+ *  |type|sz0|sz1|sz2| <-- one byte type, three byte (little endian) payload size
+ *  |payload....|      <-- 'size' bytes of payload
+ *
+ * A MessageView points into the buffer it was framed from, so it is only valid until that buffer is changed.
+ * Use dispatch_messages() to handle every complete message in a buffer and then consume them all at once:
+
+	dispatch_messages(connection->recv_buffer, [&](MessageView const &message) {
+		if (message.type == uint8_t(Message::C2S_Controls)) {
+			MessageView::Reader reader = message.reader();
+			float mouse_x = reader.read< float >(); //bounds-checked; fine for unaligned fields
+			...
+			reader.finish(); //throws on trailing data
+		}
+		return true; //keep going
+	});
+
+ */
+
+#include "Connection.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+struct MessageView {
+	uint8_t type = 0;
+	uint8_t const *payload = nullptr; //first byte of the payload (inside the framed buffer)
+	uint32_t size = 0; //payload size in bytes
+
+	static constexpr uint32_t HeaderSize = 4;
+	static constexpr uint32_t MaxSize = 0xffffff; //largest size that fits in the header
+
+	//bytes occupied by the message, including its header:
+	size_t framed_size() const { return HeaderSize + size_t(size); }
+
+	//frame the message starting at data[0]:
+	// returns 'false' (leaving *view alone) if the header or payload hasn't fully arrived
+	static bool frame(uint8_t const *data, size_t available, MessageView *view) {
+		if (available < HeaderSize) return false;
+		uint32_t size = (uint32_t(data[3]) << 16)
+		              | (uint32_t(data[2]) << 8)
+		              |  uint32_t(data[1]);
+		if (available < HeaderSize + size_t(size)) return false;
+		view->type = data[0];
+		view->payload = data + HeaderSize;
+		view->size = size;
+		return true;
+	}
+
+	//helper that writes a header for a message of type 'type' with 'size' bytes of payload to out[0,HeaderSize):
+	template< typename TYPE >
+	static void write_header(uint8_t *out, TYPE type, uint32_t size) {
+		static_assert(sizeof(TYPE) == 1, "message types are one byte");
+		if (size > MaxSize) throw std::runtime_error("Message payload of " + std::to_string(size) + " bytes is too large to frame.");
+		out[0] = uint8_t(type);
+		out[1] = uint8_t(size);
+		out[2] = uint8_t(size >> 8);
+		out[3] = uint8_t(size >> 16);
+	}
+
+	//helper that sends a header for a message of type 'type' with 'size' bytes of payload:
+	template< typename TYPE >
+	static void send_header(Connection *connection, TYPE type, uint32_t size) {
+		uint8_t header[HeaderSize];
+		write_header(header, type, size);
+		connection->send_raw(header, HeaderSize);
+	}
+
+	//sequential, bounds-checked decoding of the payload:
+	struct Reader {
+		Reader(MessageView const &message_) : message(message_) { }
+		MessageView const &message;
+		uint32_t at = 0;
+
+		uint32_t remaining() const { return message.size - at; }
+
+		//copy the next 'count' payload bytes directly into 'data':
+		void read_raw(void *data, uint32_t count) {
+			if (remaining() < count) {
+				throw std::runtime_error("Ran out of bytes reading message of type " + std::to_string(int(message.type)) + ".");
+			}
+			std::memcpy(data, message.payload + at, count);
+			at += count;
+		}
+
+		//copy the next sizeof(T) payload bytes directly into *val:
+		// (memcpy, so fields need not be aligned in the buffer)
+		template< typename T >
+		void read(T *val) {
+			static_assert(std::is_trivially_copyable< T >::value, "can only read plain-old-data from messages");
+			read_raw(val, uint32_t(sizeof(T)));
+		}
+		template< typename T >
+		T read() {
+			T val;
+			read(&val);
+			return val;
+		}
+
+		//call once all fields have been read:
+		void finish() const {
+			if (remaining() != 0) {
+				throw std::runtime_error("Trailing data in message of type " + std::to_string(int(message.type)) + ".");
+			}
+		}
+	};
+	Reader reader() const { return Reader(*this); }
+};
+
+//call 'handle(MessageView const &)' on each complete message at the front of 'buffer', in order,
+// then consume all of the handled messages from the buffer in one step.
+// 'handle' returns 'false' to stop early; that message (and any after it) stays in the buffer.
+// If 'handle' throws, nothing is consumed.
+//returns the number of messages handled.
+template< typename F >
+uint32_t dispatch_messages(Connection::Buffer &buffer, F const &handle) {
+	size_t used = 0;
+	uint32_t handled = 0;
+	MessageView message;
+	while (MessageView::frame(buffer.data() + used, buffer.size() - used, &message)) {
+		if (!handle(message)) break;
+		used += message.framed_size();
+		handled += 1;
+	}
+	buffer.consume(used);
+	return handled;
+}
@@ -6,6 +6,7 @@
 #include "Mesh.hpp"
 #include "data_path.hpp"
 #include "hex_dump.hpp"
+#include "MessageView.hpp"
 #include "UIRenderProgram.hpp"
 #include "FontRenderProgram.hpp"
 // for image import
@@ -19,6 +20,7 @@
 
 #include <random>
 #include <array>
+#include <algorithm>
 
 extern Load< UIRenderProgram > ui_render_program;
 
@@ -105,29 +107,23 @@ Load< Scene > main_scene(LoadTagDefault, []() -> Scene const * {
 PlayMode::PlayMode(Client &client_) : client(client_) {
 	scene = *main_scene;
 
-	for (auto &transform : scene.transforms) {
-		if (transform.name == "RedHamster") {
-			hamster_red.hamster_transform = &transform;
-		}
-		else if (transform.name == "BlueHamster") {
-			hamster_blue.hamster_transform = &transform;
-		}
-		else if (transform.name == "BlueLance") {
-			hamster_blue.lance_transform = &transform;
-		}
-		else if (transform.name == "BlueWheel") {
-			hamster_blue.wheel_transform = &transform;
-		}
-		else if (transform.name == "RedLance") {
-			hamster_red.lance_transform = &transform;
-		}
-		else if (transform.name == "RedWheel") {
-			hamster_red.wheel_transform = &transform;
-		}
-	}
+	std::vector< Scene::Transform * > found = scene.find_transforms({
+		"RedHamster", "RedLance", "RedWheel",
+		"BlueHamster", "BlueLance", "BlueWheel",
+	});
+	hamster_red.hamster_transform = found[0];
+	hamster_red.lance_transform = found[1];
+	hamster_red.wheel_transform = found[2];
+	hamster_blue.hamster_transform = found[3];
+	hamster_blue.lance_transform = found[4];
+	hamster_blue.wheel_transform = found[5];
+
 	auto camera_it = scene.cameras.begin();
 	std::advance(camera_it,2);
 	camera = &(*camera_it);
+
+	//tell the server how to encode game state for us:
+	game.send_handshake_message(&client.connection, false);
 }
 
 PlayMode::~PlayMode() {
@@ -144,18 +140,126 @@ void PlayMode::update_to_server_state()
 		std::advance(camera_it,2);
 		camera = &(*camera_it);
 	}
-	hamster_red.hamster_transform->position = game.players[0].position;
-	hamster_red.hamster_transform->rotation = game.players[0].rotation;
-	hamster_red.wheel_transform->rotation = game.players[0].wheel_rotation;
-	hamster_red.lance_transform->rotation = game.players[0].lance_rotation;
-	hamster_red.lance_transform->position = game.players[0].lance_position;
-
-	hamster_blue.hamster_transform->position = game.players[1].position;
-	hamster_blue.hamster_transform->rotation = game.players[1].rotation;
-	hamster_blue.wheel_transform->rotation = game.players[1].wheel_rotation;
-	hamster_blue.lance_transform->rotation = game.players[1].lance_rotation;
-	hamster_blue.lance_transform->position = game.players[1].lance_position;
 
+	//the local hamster is shown as predicted; remote hamsters are interpolated, InterpolationDelay in the past:
+	std::array< Player, 2 > shown = game.players;
+	if (snapshot_ring_count != 0) {
+		bool underrun = false;
+		std::array< Player, 2 > interpolated = interpolate_players(local_time + server_time_offset - InterpolationDelay, &underrun);
+		for (uint32_t i = 0; i < 2; ++i) {
+			if (i != uint32_t(game.player_type)) shown[i] = interpolated[i];
+		}
+
+		InterpolationStats &stats = interpolation_stats;
+		stats.frames += 1;
+		if (underrun) {
+			stats.underrun_frames += 1;
+			if (!stats.in_underrun) {
+				stats.in_underrun = true;
+				stats.underruns += 1;
+				stats.underrun_start = local_time;
+			}
+			stats.longest_underrun = std::max(stats.longest_underrun, local_time - stats.underrun_start);
+		} else {
+			stats.in_underrun = false;
+		}
+		if (local_time >= stats.report_at) {
+			if (stats.underruns != 0) {
+				std::cout << "Interpolation ran past the newest state " << stats.underruns << " time(s) in the last 5s ("
+				          << stats.underrun_frames << " of " << stats.frames << " frames; longest " << int(stats.longest_underrun * 1000.0) << "ms)." << std::endl;
+			}
+			bool in_underrun = stats.in_underrun;
+			stats = InterpolationStats();
+			stats.in_underrun = in_underrun;
+			stats.underrun_start = local_time;
+			stats.report_at = local_time + 5.0;
+		}
+	}
+
+	hamster_red.hamster_transform->position = shown[0].position;
+	hamster_red.hamster_transform->rotation = shown[0].rotation;
+	hamster_red.wheel_transform->rotation = shown[0].wheel_rotation;
+	hamster_red.lance_transform->rotation = shown[0].lance_rotation;
+	hamster_red.lance_transform->position = shown[0].lance_position;
+
+	hamster_blue.hamster_transform->position = shown[1].position;
+	hamster_blue.hamster_transform->rotation = shown[1].rotation;
+	hamster_blue.wheel_transform->rotation = shown[1].wheel_rotation;
+	hamster_blue.lance_transform->rotation = shown[1].lance_rotation;
+	hamster_blue.lance_transform->position = shown[1].lance_position;
+
+}
+
+void PlayMode::record_snapshot(Game::Snapshot const &snapshot) {
+	TimedSnapshot timed;
+	timed.time = double(snapshot.seq) / double(std::max(snapshot.tick_rate, uint8_t(1)));
+	timed.players = snapshot.players;
+
+	//server time runs at the same rate as local time, so track the offset between them:
+	// (smoothed, since snapshots arrive with jitter; reset on big jumps, e.g., a server restart)
+	double offset = timed.time - local_time;
+	if (!server_time_known || std::abs(offset - server_time_offset) > 0.5) {
+		server_time_offset = offset;
+		server_time_known = true;
+		snapshot_ring_count = 0;
+	} else {
+		server_time_offset += 0.05 * (offset - server_time_offset);
+	}
+
+	//snapshots arrive in order, so a full ring just drops the oldest:
+	uint32_t size = uint32_t(snapshot_ring.size());
+	if (snapshot_ring_count != 0 && timed.time <= snapshot_ring[(snapshot_ring_begin + snapshot_ring_count - 1) % size].time) return;
+	if (snapshot_ring_count == size) {
+		snapshot_ring_begin = (snapshot_ring_begin + 1) % size;
+		snapshot_ring_count -= 1;
+	}
+	snapshot_ring[(snapshot_ring_begin + snapshot_ring_count) % size] = timed;
+	snapshot_ring_count += 1;
+}
+
+std::array< Player, 2 > PlayMode::interpolate_players(double time, bool *underrun) const {
+	assert(snapshot_ring_count != 0);
+	uint32_t size = uint32_t(snapshot_ring.size());
+	auto at = [&](uint32_t i) -> TimedSnapshot const & {
+		return snapshot_ring[(snapshot_ring_begin + i) % size];
+	};
+
+	*underrun = false;
+
+	//before everything in the ring: show the oldest
+	if (time <= at(0).time) return at(0).players;
+
+	//past the newest: keep moving along the last known velocity for a bit, then hold still:
+	TimedSnapshot const &newest = at(snapshot_ring_count - 1);
+	if (time >= newest.time) {
+		*underrun = (time > newest.time);
+		std::array< Player, 2 > players = newest.players;
+		float ahead = float(std::min(time - newest.time, double(MaxExtrapolation)));
+		for (auto &p : players) {
+			p.position += p.velocity * ahead;
+		}
+		return players;
+	}
+
+	//between two snapshots: blend
+	uint32_t i = 1;
+	while (at(i).time <= time) ++i;
+	TimedSnapshot const &a = at(i - 1);
+	TimedSnapshot const &b = at(i);
+	float t = float((time - a.time) / (b.time - a.time));
+
+	std::array< Player, 2 > players = b.players;
+	for (uint32_t p = 0; p < 2; ++p) {
+		Player const &pa = a.players[p];
+		Player const &pb = b.players[p];
+		players[p].position = glm::mix(pa.position, pb.position, t);
+		players[p].velocity = glm::mix(pa.velocity, pb.velocity, t);
+		players[p].lance_position = glm::mix(pa.lance_position, pb.lance_position, t);
+		players[p].rotation = glm::slerp(pa.rotation, pb.rotation, t);
+		players[p].lance_rotation = glm::slerp(pa.lance_rotation, pb.lance_rotation, t);
+		players[p].wheel_rotation = glm::slerp(pa.wheel_rotation, pb.wheel_rotation, t);
+	}
+	return players;
 }
 
 bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size) {
@@ -185,7 +289,7 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 		} else if (evt.key.keysym.sym == SDLK_ESCAPE) {
 			SDL_SetRelativeMouseMode(SDL_FALSE);
 		} else if (evt.key.keysym.sym == SDLK_e && game.game_state == Game::WaitingForPlayer) {
-			game.send_handshake_message(&client.connection);
+			game.send_handshake_message(&client.connection, true);
 			return true;
 		}
 	} else if (evt.type == SDL_KEYUP) {
@@ -229,10 +333,11 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 }
 
 void PlayMode::update(float elapsed) {
+	local_time += elapsed;
 
-	//queue data for sending to server:
+	//queue data for sending to server, and move the local hamster right away (see Game::send_predicted_controls):
 	if (game.player_type != Spectator && game.game_state == Game::GameState::InGame) {
-		controls.send_controls_message(&client.connection);
+		game.send_predicted_controls(&client.connection, controls, elapsed);
 	}
 
 	//reset button press counters:
@@ -252,16 +357,29 @@ void PlayMode::update(float elapsed) {
 			std::cout << "[" << c->socket << "] closed (!)" << std::endl;
 			throw std::runtime_error("Lost connection to server!");
 		} else { assert(event == Connection::OnRecv);
-			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
-			bool handled_message;
+			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
 			try {
-				do {
-					handled_message = false;
-					if (game.recv_state_message(c)) {
-						handled_message = true;
-						update_to_server_state();
+				bool got_state = false;
+				bool lost_baseline = false;
+				dispatch_messages(c->recv_buffer, [&](MessageView const &message) {
+					if (message.type == uint8_t(Message::S2C_State) || message.type == uint8_t(Message::S2C_StateDelta)) {
+						if (game.recv_state_message(message)) {
+							record_snapshot(game.received_snapshots.back());
+							got_state = true;
+						} else {
+							lost_baseline = true;
+						}
+					} else {
+						throw std::runtime_error("Unexpected message type " + std::to_string(int(message.type)) + ".");
 					}
-				} while (handled_message);
+					return true;
+				});
+				//let the server know which state to send deltas from (or that a full state is needed):
+				if (lost_baseline) {
+					game.send_state_ack_message(c, 0);
+				} else if (got_state) {
+					game.send_state_ack_message(c, game.received_snapshots.back().seq);
+				}
 			} catch (std::exception const &e) {
 				std::cerr << "[" << c->socket << "] malformed message from server: " << e.what() << std::endl;
 				//quit the game:
@@ -270,6 +388,8 @@ void PlayMode::update(float elapsed) {
 		}
 	}, 0.0);
 
+	//show the new state (or the next interpolated frame of the old one):
+	update_to_server_state();
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
@@ -6,6 +6,7 @@
 
 #include <glm/glm.hpp>
 
+#include <array>
 #include <vector>
 #include <deque>
 
@@ -27,9 +28,48 @@ struct PlayMode : Mode {
 
 	//----- game state -----
 
-	//handle new game state passed from server
+	//show the latest game state (local hamster as predicted, remote hamsters interpolated):
 	void update_to_server_state();
 
+	//----- remote hamster interpolation -----
+
+	//remote hamsters are drawn InterpolationDelay behind the newest state, blended between the two snapshots
+	// around that time, so 30Hz state that arrives with jitter still moves smoothly at any frame rate:
+	inline static constexpr float InterpolationDelay = Game::InterpolationDelay; //seconds (the server rewinds lance hits by as much)
+	inline static constexpr float MaxExtrapolation = 0.1f; //seconds past the newest snapshot to keep moving (on gaps) before holding still
+
+	//received snapshots (server time is seq / the server's tick_rate), in a ring, oldest first:
+	struct TimedSnapshot {
+		double time = 0.0; //server time
+		std::array< Player, 2 > players;
+	};
+	std::array< TimedSnapshot, 64 > snapshot_ring; //(enough for ~0.5s of 120Hz state)
+	uint32_t snapshot_ring_begin = 0; //index of the oldest snapshot
+	uint32_t snapshot_ring_count = 0;
+
+	//clocks:
+	double local_time = 0.0; //seconds of update()
+	double server_time_offset = 0.0; //smoothed estimate of (server time - local_time) as snapshots arrive
+	bool server_time_known = false;
+
+	//add a snapshot (as sent by the server, before prediction) to the ring:
+	void record_snapshot(Game::Snapshot const &snapshot);
+
+	//players as of server time 'time', from the ring (extrapolated past the newest snapshot, up to MaxExtrapolation):
+	// sets *underrun if 'time' is past the newest snapshot
+	std::array< Player, 2 > interpolate_players(double time, bool *underrun) const;
+
+	//how often the ring ran dry (reported every few seconds, if it did):
+	struct InterpolationStats {
+		uint32_t frames = 0; //frames shown
+		uint32_t underrun_frames = 0; //frames shown past the newest snapshot
+		uint32_t underruns = 0; //times the ring ran dry
+		double longest_underrun = 0.0; //seconds
+		double underrun_start = 0.0; //(local time the current underrun started)
+		bool in_underrun = false;
+		double report_at = 5.0; //local time of the next report
+	} interpolation_stats;
+
 	//input tracking for local player:
 	Player::Controls controls;
 
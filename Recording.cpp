@@ -0,0 +1,137 @@
+#include "Recording.hpp"
+
+#include "read_write_chunk.hpp"
+
+#include <cassert>
+#include <fstream>
+#include <stdexcept>
+
+void Recording::start(Game const &game) {
+	header = Header();
+	header.first_tick = game.tick;
+	header.max_rewind = game.max_rewind;
+	header.tick_rate = game.tick_rate;
+	ticks.clear();
+	commands.clear();
+}
+
+void Recording::update(Game &game, float elapsed) {
+	assert(game.tick == header.first_tick + ticks.size());
+
+	Tick tick;
+	tick.view_tick = game.view_tick;
+	tick.move_budget = game.move_budget;
+	tick.game_state = uint8_t(game.game_state);
+	tick.player_ready = uint8_t((game.player_ready[0] ? 1 : 0) | (game.player_ready[1] ? 2 : 0));
+	for (uint32_t i = 0; i < 2; ++i) {
+		tick.controls[i] = game.players[i].controls;
+		//(queue_command keeps the queue short enough to count; this runs in a step job, so it mustn't throw)
+		static_assert(Game::MaxQueuedCommands <= 0xffff, "command_count is a uint16_t");
+		assert(game.commands[i].size() <= Game::MaxQueuedCommands);
+		tick.command_count[i] = uint16_t(game.commands[i].size());
+		for (Player::Command const &queued : game.commands[i]) {
+			Command &command = commands.emplace_back();
+			command.seq = queued.seq;
+			command.elapsed = queued.elapsed;
+			command.mouse_x = queued.mouse_x;
+			command.buttons = uint8_t((queued.left ? 1 : 0) | (queued.right ? 2 : 0) | (queued.up ? 4 : 0) | (queued.down ? 8 : 0));
+		}
+	}
+
+	game.update(elapsed);
+
+	tick.checksum = checksum(game);
+	ticks.emplace_back(tick);
+}
+
+uint32_t Recording::play(Game *game_) const {
+	assert(game_);
+	Game &game = *game_;
+
+	game.tick = header.first_tick;
+	game.max_rewind = header.max_rewind;
+	game.tick_rate = header.tick_rate;
+
+	auto command = commands.begin();
+	for (uint32_t t = 0; t < uint32_t(ticks.size()); ++t) {
+		Tick const &tick = ticks[t];
+		game.view_tick = tick.view_tick;
+		game.move_budget = tick.move_budget;
+		game.game_state = Game::GameState(tick.game_state);
+		game.player_ready[0] = (tick.player_ready & 1) != 0;
+		game.player_ready[1] = (tick.player_ready & 2) != 0;
+		for (uint32_t i = 0; i < 2; ++i) {
+			game.players[i].controls = tick.controls[i];
+			game.commands[i].clear();
+			for (uint32_t c = 0; c < tick.command_count[i]; ++c, ++command) {
+				if (command == commands.end()) throw std::runtime_error("Recording has fewer commands than its ticks use.");
+				Player::Command &queued = game.commands[i].emplace_back();
+				queued.seq = command->seq;
+				queued.elapsed = command->elapsed;
+				queued.mouse_x = command->mouse_x;
+				queued.left = (command->buttons & 1) != 0;
+				queued.right = (command->buttons & 2) != 0;
+				queued.up = (command->buttons & 4) != 0;
+				queued.down = (command->buttons & 8) != 0;
+			}
+		}
+
+		game.update(game.tick_length());
+
+		if (checksum(game) != tick.checksum) return t;
+	}
+	return uint32_t(ticks.size());
+}
+
+uint32_t Recording::checksum(Game const &game) {
+	//FNV-1a over the raw bytes of each field:
+	uint32_t hash = 2166136261u;
+	auto add = [&hash](auto const &field) {
+		uint8_t const *bytes = reinterpret_cast< uint8_t const * >(&field);
+		for (size_t b = 0; b < sizeof(field); ++b) {
+			hash = (hash ^ bytes[b]) * 16777619u;
+		}
+	};
+	add(game.tick);
+	add(game.game_state);
+	for (Player const &player : game.players) {
+		add(player.health);
+		add(player.since_attack);
+		add(player.has_hit_this_attack);
+		add(player.position);
+		add(player.velocity);
+		add(player.rotation);
+		add(player.lance_position);
+		add(player.lance_rotation);
+		add(player.wheel_rotation);
+	}
+	return hash;
+}
+
+void Recording::save(std::ostream &to) const {
+	write_chunk("rph0", std::vector< Header >{ header }, &to);
+	write_chunk("rpt1", ticks, &to);
+	write_chunk("rpc0", commands, &to);
+	if (!to) throw std::runtime_error("Failed to write recording.");
+}
+
+void Recording::load(std::istream &from) {
+	std::vector< Header > headers;
+	read_chunk(from, "rph0", &headers);
+	if (headers.size() != 1) throw std::runtime_error("Recording should have exactly one header.");
+	header = headers[0];
+	read_chunk(from, "rpt1", &ticks);
+	read_chunk(from, "rpc0", &commands);
+}
+
+void Recording::save(std::string const &filename) const {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file) throw std::runtime_error("Failed to open '" + filename + "' for writing.");
+	save(file);
+}
+
+void Recording::load(std::string const &filename) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) throw std::runtime_error("Failed to open '" + filename + "'.");
+	load(file);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+/*
+ * A Recording captures everything a server feeds into one match's Game::update, tick by tick,
+ * so the match can be re-simulated exactly later (e.g., with dist/replay):
+
+	Recording recording;
+	recording.start(game); //before the first update
+	...
+	recording.update(game, game.tick_length()); //instead of game.update(...)
+	...
+	recording.save("match.replay");
+
+	Recording loaded;
+	loaded.load("match.replay");
+	Game replayed;
+	uint32_t diverged = loaded.play(&replayed); //== loaded.ticks.size() => same result on every tick
+
+ * The initial state is whatever Game() builds from arena.scene, plus the settings in Header;
+ * so a recording only plays back the same with the same arena and Game code.
+ * Files are read_write_chunk.hpp chunks, in native byte order (like the scene files).
+ */
+
+#include "Game.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Recording {
+	struct Header {
+		uint32_t first_tick = 0; //Game::tick before the first update
+		float max_rewind = 0.0f;
+		uint8_t tick_rate = Game::TickRate;
+		uint8_t padding[3] = {0, 0, 0};
+	};
+	static_assert(sizeof(Header) == 12, "header is packed");
+
+	//one Game::update:
+	struct Tick {
+		//each player's controls, as update() saw them:
+		std::array< Player::Controls, 2 > controls;
+		//the game state the server left before update() (players joining/leaving and starting play):
+		std::array< uint32_t, 2 > view_tick = {0, 0};
+		std::array< float, 2 > move_budget = {0.0f, 0.0f}; //(reset when a player joins)
+		//movement commands queued for each player, stored in order in 'commands':
+		std::array< uint16_t, 2 > command_count = {0, 0};
+		uint8_t game_state = 0;
+		uint8_t player_ready = 0; //bit i => player_ready[i]
+		uint8_t padding[2] = {0, 0};
+		//checksum of the state after update() (see checksum()):
+		uint32_t checksum = 0;
+	};
+	static_assert(sizeof(Tick) == 60, "tick is packed");
+
+	struct Command {
+		uint32_t seq = 0;
+		float elapsed = 0.0f;
+		float mouse_x = 0.0f;
+		uint8_t buttons = 0; //bits: left, right, up, down
+		uint8_t padding[3] = {0, 0, 0};
+	};
+	static_assert(sizeof(Command) == 16, "command is packed");
+
+	Header header;
+	std::vector< Tick > ticks;
+	std::vector< Command > commands;
+
+	//start recording 'game' (before its first update):
+	void start(Game const &game);
+
+	//record the inputs to game.update(elapsed), call it, and record a checksum of the result:
+	void update(Game &game, float elapsed);
+
+	//re-simulate the recording with 'game' (freshly constructed):
+	//returns the index of the first tick whose result differed from the recorded one (ticks.size() => none did)
+	uint32_t play(Game *game) const;
+
+	//hash of the simulated part of the game state:
+	static uint32_t checksum(Game const &game);
+
+	//save or load (throws on errors):
+	void save(std::ostream &to) const;
+	void load(std::istream &from);
+	void save(std::string const &filename) const;
+	void load(std::string const &filename);
+};
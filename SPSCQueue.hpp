@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * SPSCQueue is a fixed-size, lock-free queue for handing items from one thread (the producer)
+ * to one other thread (the consumer), e.g., decoded controls from the network thread to a match:
+
+	SPSCQueue< Input, 256 > inbox;
+
+	//producer:
+	if (!inbox.push(input)) { ...full; drop it or try later... }
+
+	//consumer:
+	Input input;
+	while (inbox.pop(&input)) { ... }
+
+ * Only one thread may push and only one thread may pop at a time. The consumer may change from one
+ * thread to another as long as something else (e.g., ThreadPool::wait) orders the two.
+ */
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+template< typename T, size_t Capacity >
+struct SPSCQueue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+	//add an item at the back (producer only); returns 'false' (and drops the item) if the queue is full:
+	bool push(T const &item) {
+		size_t back = tail.load(std::memory_order_relaxed);
+		if (back - head.load(std::memory_order_acquire) == Capacity) return false;
+		items[back & (Capacity - 1)] = item;
+		tail.store(back + 1, std::memory_order_release);
+		return true;
+	}
+
+	//take the item at the front (consumer only); returns 'false' if the queue is empty:
+	bool pop(T *item) {
+		size_t front = head.load(std::memory_order_relaxed);
+		if (front == tail.load(std::memory_order_acquire)) return false;
+		*item = items[front & (Capacity - 1)];
+		head.store(front + 1, std::memory_order_release);
+		return true;
+	}
+
+	//internals:
+	// (head and tail padded onto separate cache lines, so the two threads don't fight over one line)
+	std::atomic< size_t > head{0}; //next item to pop
+	char head_padding[64 - sizeof(std::atomic< size_t >)];
+	std::atomic< size_t > tail{0}; //next slot to push
+	char tail_padding[64 - sizeof(std::atomic< size_t >)];
+	std::array< T, Capacity > items;
+};
@@ -5,11 +5,14 @@
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 
 //-------------------------
 
-glm::mat4x3 Scene::Transform::make_local_to_parent() const {
+//(shared by Transform::make_local_to_parent and Flat::update_world)
+static glm::mat4x3 make_local_to_parent(glm::vec3 const &position, glm::quat const &rotation, glm::vec3 const &scale) {
 	//compute:
 	//   translate   *   rotate    *   scale
 	// [ 1 0 0 p.x ]   [       0 ]   [ s.x 0 0 0 ]
@@ -26,6 +29,10 @@ glm::mat4x3 Scene::Transform::make_local_to_parent() const {
 	);
 }
 
+glm::mat4x3 Scene::Transform::make_local_to_parent() const {
+	return ::make_local_to_parent(position, rotation, scale);
+}
+
 glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 	//compute:
 	//   1/scale       *    rot^-1   *  translate^-1
@@ -73,45 +80,171 @@ glm::mat4x3 Scene::Transform::make_world_to_local() const {
 
 //-------------------------
 
+void Scene::update_world() const {
+	//the order needs to be rebuilt if transforms were added, removed, or re-parented:
+	bool rebuild = !world_order_current();
+
+	if (rebuild) {
+		world.order.clear();
+		world.parents.clear();
+		for (auto const &t : transforms) {
+			t.world_index = -1U;
+		}
+		//place each transform right after its not-yet-placed ancestors:
+		std::vector< Transform const * > chain;
+		for (auto const &t : transforms) {
+			for (Transform const *at = &t; at && at->world_index == -1U; at = at->parent) {
+				chain.emplace_back(at);
+			}
+			for (auto at = chain.rbegin(); at != chain.rend(); ++at) {
+				(*at)->world_index = uint32_t(world.order.size());
+				world.order.emplace_back(*at);
+				world.parents.emplace_back((*at)->parent ? (*at)->parent->world_index : -1U);
+			}
+			chain.clear();
+		}
+		world.locals.resize(world.order.size());
+		world.local_to_world.resize(world.order.size());
+		world.stamps.resize(world.order.size());
+		world.parent_stamps.resize(world.order.size());
+	}
+
+	//recompute matrices of transforms that moved or whose parent's matrix changed:
+	// (parents come first, so their stamps are already up to date)
+	for (uint32_t i = 0; i < uint32_t(world.order.size()); ++i) {
+		if (rebuild || world_changed(i)) world_compute(i);
+	}
+}
+
+bool Scene::world_order_current() const {
+	if (world.order.size() != transforms.size()) return false;
+	for (auto const &t : transforms) {
+		if (t.world_index >= world.order.size() || world.order[t.world_index] != &t
+		 || world.parents[t.world_index] != (t.parent ? t.parent->world_index : -1U)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+glm::mat4x3 const &Scene::world_matrix(Transform const &transform) const {
+	uint32_t i = transform.world_index;
+	//transforms added or re-parented since the last update_world() need the order rebuilt first:
+	if (i >= world.order.size() || world.order[i] != &transform
+	 || world.parents[i] != (transform.parent ? transform.parent->world_index : -1U)) {
+		update_world();
+		i = transform.world_index;
+		if (i >= world.order.size() || world.order[i] != &transform) throw std::runtime_error("Transform passed to world_matrix() isn't in the scene.");
+	}
+	if (world.parents[i] != -1U) {
+		world_matrix(*world.order[world.parents[i]]);
+		i = transform.world_index; //(in case an ancestor's lookup rebuilt the order)
+	}
+	if (world_changed(i)) world_compute(i);
+	return world.local_to_world[i];
+}
+
+bool Scene::world_changed(uint32_t i) const {
+	//(compared bitwise, so a transform only counts as unchanged if its matrix would come out identical)
+	Transform const &t = *world.order[i];
+	World::Local const &local = world.locals[i];
+	uint32_t parent = world.parents[i];
+	return (parent != -1U && world.parent_stamps[i] != world.stamps[parent])
+		|| std::memcmp(&local.position, &t.position, sizeof(t.position)) != 0
+		|| std::memcmp(&local.rotation, &t.rotation, sizeof(t.rotation)) != 0
+		|| std::memcmp(&local.scale, &t.scale, sizeof(t.scale)) != 0;
+}
+
+void Scene::world_compute(uint32_t i) const {
+	Transform const &t = *world.order[i];
+	uint32_t parent = world.parents[i];
+	world.locals[i].position = t.position;
+	world.locals[i].rotation = t.rotation;
+	world.locals[i].scale = t.scale;
+	//(same arithmetic as make_local_to_world, so results are identical)
+	if (parent == -1U) {
+		world.local_to_world[i] = t.make_local_to_parent();
+		world.parent_stamps[i] = 0;
+	} else {
+		world.local_to_world[i] = world.local_to_world[parent] * glm::mat4(t.make_local_to_parent());
+		world.parent_stamps[i] = world.stamps[parent];
+	}
+	world.computed += 1;
+	world.stamps[i] = world.computed;
+}
+
+//-------------------------
+
 glm::mat4 Scene::Camera::make_projection() const {
 	return glm::infinitePerspective( fovy, aspect, near );
 }
 
 //-------------------------
 
-
-void Scene::draw(Camera const &camera) const {
-	assert(camera.transform);
-	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
-	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
-	draw(world_to_clip, world_to_light);
+//Drawables are queued, then sorted so that draws sharing a program (then vertex array, then textures) go together:
+// (shared by Scene::draw and Scene::Flat::draw)
+struct QueuedDraw {
+	Scene::Drawable::Pipeline const *pipeline;
+	glm::mat4x3 const *object_to_world;
+};
+
+static void queue_draw(std::vector< QueuedDraw > *queue, Scene::Drawable::Pipeline const &pipeline, glm::mat4x3 const &object_to_world) {
+	//skip any drawables without a shader program set:
+	if (pipeline.program == 0) return;
+	//skip any drawables that don't reference any vertex array:
+	if (pipeline.vao == 0) return;
+	//skip any drawables that don't contain any vertices:
+	if (pipeline.count == 0) return;
+
+	queue->emplace_back(QueuedDraw{ &pipeline, &object_to_world });
 }
 
-void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
-	//Iterate through all drawables, sending each one to OpenGL:
-	for (auto const &drawable : drawables) {
-		//Reference to drawable's pipeline for convenience:
-		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+static Scene::DrawStats draw_queue(std::vector< QueuedDraw > *queue_, glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) {
+	assert(queue_);
+	auto &queue = *queue_;
+	using Pipeline = Scene::Drawable::Pipeline;
+
+	//(stable, so drawables with the same state are still drawn in scene order)
+	std::stable_sort(queue.begin(), queue.end(), [](QueuedDraw const &a, QueuedDraw const &b) {
+		Pipeline const &pa = *a.pipeline;
+		Pipeline const &pb = *b.pipeline;
+		if (pa.program != pb.program) return pa.program < pb.program;
+		if (pa.vao != pb.vao) return pa.vao < pb.vao;
+		for (uint32_t i = 0; i < Pipeline::TextureCount; ++i) {
+			if (pa.textures[i].texture != pb.textures[i].texture) return pa.textures[i].texture < pb.textures[i].texture;
+		}
+		return false;
+	});
 
-		//skip any drawables without a shader program set:
-		if (pipeline.program == 0) continue;
-		//skip any drawables that don't reference any vertex array:
-		if (pipeline.vao == 0) continue;
-		//skip any drawables that don't contain any vertices:
-		if (pipeline.count == 0) continue;
+	Scene::DrawStats stats;
 
+	//state left by the previous draw (draw() starts and ends with nothing bound):
+	GLuint program = 0;
+	GLuint vao = 0;
+	Pipeline::TextureInfo bound[Pipeline::TextureCount];
+	uint32_t active = 0; //active texture unit
+
+	for (QueuedDraw const &draw : queue) {
+		//Reference to drawable's pipeline for convenience:
+		Pipeline const &pipeline = *draw.pipeline;
 
 		//Set shader program:
-		glUseProgram(pipeline.program);
+		if (pipeline.program != program) {
+			glUseProgram(pipeline.program);
+			program = pipeline.program;
+			stats.programs += 1;
+		}
 
 		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+		if (pipeline.vao != vao) {
+			glBindVertexArray(pipeline.vao);
+			vao = pipeline.vao;
+			stats.vaos += 1;
+		}
 
 		//Configure program uniforms:
-
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+		// (the object-to-world matrix is used in all three of these uniforms)
+		glm::mat4x3 const &object_to_world = *draw.object_to_world;
 
 		//OBJECT_TO_CLIP takes vertices from object space to clip space:
 		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
@@ -136,31 +269,68 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 		//set any requested custom uniforms:
 		if (pipeline.set_uniforms) pipeline.set_uniforms();
 
-		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
+		//set up textures (units this drawable doesn't use are left un-bound, as if each draw un-bound its own):
+		for (uint32_t i = 0; i < Pipeline::TextureCount; ++i) {
+			Pipeline::TextureInfo const &want = pipeline.textures[i];
+			Pipeline::TextureInfo &have = bound[i];
+			if (want.texture == have.texture && (want.texture == 0 || want.target == have.target)) continue;
+
+			if (active != i) {
 				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+				active = i;
+			}
+			if (have.texture != 0 && (want.texture == 0 || want.target != have.target)) {
+				glBindTexture(have.target, 0);
+				stats.textures += 1;
 			}
+			if (want.texture != 0) {
+				glBindTexture(want.target, want.texture);
+				stats.textures += 1;
+			}
+			have = want;
 		}
 
 		//draw the object:
 		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		stats.draws += 1;
+	}
 
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
-			}
+	//un-bind textures:
+	for (uint32_t i = 0; i < Pipeline::TextureCount; ++i) {
+		if (bound[i].texture != 0) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(bound[i].target, 0);
+			stats.textures += 1;
 		}
-		glActiveTexture(GL_TEXTURE0);
-
 	}
+	glActiveTexture(GL_TEXTURE0);
 
 	glUseProgram(0);
 	glBindVertexArray(0);
 
+	return stats;
+}
+
+void Scene::draw(Camera const &camera) const {
+	assert(camera.transform);
+	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
+	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
+	draw(world_to_clip, world_to_light);
+}
+
+void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	update_world();
+
+	//Queue up all drawables, then send them to OpenGL:
+	std::vector< QueuedDraw > queue;
+	queue.reserve(drawables.size());
+	for (auto const &drawable : drawables) {
+		assert(drawable.transform); //drawables *must* have a transform
+		// (update_world() above brought every cached matrix up to date)
+		queue_draw(&queue, drawable.pipeline, world.local_to_world[drawable.transform->world_index]);
+	}
+	draw_stats = draw_queue(&queue, world_to_clip, world_to_light);
+
 	GL_ERRORS();
 }
 
@@ -303,6 +473,10 @@ void Scene::load(std::string const &filename,
 	//load any extra that a subclass wants:
 	load_extra(file, names, hierarchy_transforms);
 
+	//(so copies of the loaded scene can remap transforms by index and look them up by name)
+	update_world();
+	index_names();
+
 	if (file.peek() != EOF) {
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
@@ -326,51 +500,226 @@ Scene &Scene::operator=(Scene const &other) {
 	return *this;
 }
 
-void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map_) {
+void Scene::set(Scene const &other, std::unordered_map< Transform const *, Transform * > *transform_map) {
+	if (&other == this) return;
 
-	std::unordered_map< Transform const *, Transform * > t2t_temp;
-	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
+	//Copy transforms into this scene's existing list nodes (only adding or removing nodes to match the count):
+	transforms.resize(other.transforms.size());
 
-	transform_to_transform.clear();
+	//Transform pointers are remapped by index rather than through a hash map:
+	// if other's world-matrix cache is current, its world_index is already an index for every transform;
+	// otherwise, transforms are found by binary search in a table sorted by address.
+	bool indexed = other.world_order_current();
+	std::vector< Transform * > copies; //copy of other.world.order[i]
+	std::vector< std::pair< Transform const *, Transform * > > by_address;
+	if (indexed) copies.resize(other.transforms.size());
+	else by_address.reserve(other.transforms.size());
 
-	//null transform maps to itself:
-	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
+	//copies share other's name index, since they keep the same names in the same order:
+	// (unless other's index is already stale by count, which a copy of it couldn't detect)
+	name_positions = (other.by_position.size() == other.transforms.size() ? other.name_positions : nullptr);
+	by_position.clear();
+	if (name_positions) by_position.reserve(other.transforms.size());
 
-	//Copy transforms and store mapping:
-	transforms.clear();
+	auto copy = transforms.begin();
 	for (auto const &t : other.transforms) {
-		transforms.emplace_back();
-		transforms.back().name = t.name;
-		transforms.back().position = t.position;
-		transforms.back().rotation = t.rotation;
-		transforms.back().scale = t.scale;
-		transforms.back().parent = t.parent; //will update later
-
-		//store mapping between transforms old and new:
-		auto ret = transform_to_transform.insert(std::make_pair(&t, &transforms.back()));
-		assert(ret.second);
+		if (name_positions) by_position.emplace_back(&*copy);
+		copy->name = t.name;
+		copy->position = t.position;
+		copy->rotation = t.rotation;
+		copy->scale = t.scale;
+		if (indexed) {
+			copies[t.world_index] = &*copy;
+		} else {
+			by_address.emplace_back(&t, &*copy);
+		}
+		++copy;
 	}
+	if (!indexed) std::sort(by_address.begin(), by_address.end());
+
+	auto copy_of = [&](Transform const *t) -> Transform * {
+		if (t == nullptr) return nullptr;
+		if (indexed) {
+			if (t->world_index < copies.size() && other.world.order[t->world_index] == t) return copies[t->world_index];
+		} else {
+			auto f = std::lower_bound(by_address.begin(), by_address.end(), std::make_pair(t, (Transform *)nullptr));
+			if (f != by_address.end() && f->first == t) return f->second;
+		}
+		throw std::runtime_error("Can't copy a scene that refers to transforms from another scene.");
+	};
 
 	//update transform parents:
-	for (auto &t : transforms) {
-		t.parent = transform_to_transform.at(t.parent);
+	copy = transforms.begin();
+	for (auto const &t : other.transforms) {
+		copy->parent = copy_of(t.parent);
+		++copy;
 	}
 
 	//copy other's drawables, updating transform pointers:
 	drawables = other.drawables;
 	for (auto &d : drawables) {
-		d.transform = transform_to_transform.at(d.transform);
+		d.transform = copy_of(d.transform);
 	}
 
 	//copy other's cameras, updating transform pointers:
 	cameras = other.cameras;
 	for (auto &c : cameras) {
-		c.transform = transform_to_transform.at(c.transform);
+		c.transform = copy_of(c.transform);
 	}
 
 	//copy other's lights, updating transform pointers:
 	lights = other.lights;
 	for (auto &l : lights) {
-		l.transform = transform_to_transform.at(l.transform);
+		l.transform = copy_of(l.transform);
+	}
+
+	//world matrices get recomputed on the next update_world():
+	// (rebuilding the cache then is quicker than copying other's here)
+	world.order.clear();
+
+	//(the mapping is only built if requested)
+	if (transform_map) {
+		transform_map->clear();
+		transform_map->insert(std::make_pair(nullptr, nullptr));
+		copy = transforms.begin();
+		for (auto const &t : other.transforms) {
+			transform_map->insert(std::make_pair(&t, &*copy));
+			++copy;
+		}
+	}
+}
+
+//-------------------------
+
+Scene::Transform *Scene::find_transform(std::string const &name) {
+	return const_cast< Transform * >(static_cast< Scene const & >(*this).find_transform(name));
+}
+
+Scene::Transform const *Scene::find_transform(std::string const &name) const {
+	if (name_positions) {
+		//(a stale index can point at removed transforms, so it's only checked by count, never by looking at them:)
+		if (by_position.size() == transforms.size()) {
+			auto f = name_positions->find(name);
+			return (f != name_positions->end() ? by_position[f->second] : nullptr);
+		}
+	}
+	//not indexed (or stale by count):
+	for (auto const &t : transforms) {
+		if (t.name == name) return &t;
+	}
+	return nullptr;
+}
+
+std::vector< Scene::Transform * > Scene::find_transforms(std::vector< std::string > const &names) {
+	std::vector< Transform * > found;
+	found.reserve(names.size());
+	for (auto const &name : names) {
+		Transform *transform = find_transform(name);
+		if (!transform) throw std::runtime_error("Scene has no transform named '" + name + "'.");
+		found.emplace_back(transform);
+	}
+	return found;
+}
+
+void Scene::index_names() {
+	auto positions = std::make_shared< std::unordered_map< std::string, uint32_t > >();
+	positions->reserve(transforms.size());
+	by_position.clear();
+	by_position.reserve(transforms.size());
+	for (auto &t : transforms) {
+		positions->emplace(t.name, uint32_t(by_position.size())); //(keeps the first transform with each name)
+		by_position.emplace_back(&t);
+	}
+	name_positions = positions;
+}
+
+//-------------------------
+
+Scene::Flat::Flat(Scene const &scene) {
+	//(the world-matrix cache already has every transform parents-first, so flat indices are world indices)
+	scene.update_world();
+	uint32_t count = uint32_t(scene.world.order.size());
+
+	positions.reserve(count);
+	rotations.reserve(count);
+	scales.reserve(count);
+	parents.reserve(count);
+	name_ends.reserve(count);
+	for (Transform const *t : scene.world.order) {
+		positions.emplace_back(t->position);
+		rotations.emplace_back(t->rotation);
+		scales.emplace_back(t->scale);
+		parents.emplace_back(t->parent ? t->parent->world_index : -1U);
+		names.insert(names.end(), t->name.begin(), t->name.end());
+		name_ends.emplace_back(uint32_t(names.size()));
+	}
+
+	//(attached objects must reference transforms in this scene)
+	auto index = [&](Transform const *transform) {
+		assert(transform && transform->world_index < count && scene.world.order[transform->world_index] == transform);
+		return transform->world_index;
+	};
+
+	auto flat_pipelines = std::make_shared< std::vector< Drawable::Pipeline > >();
+	flat_pipelines->reserve(scene.drawables.size());
+	drawables.reserve(scene.drawables.size());
+	for (auto const &d : scene.drawables) {
+		drawables.emplace_back(index(d.transform));
+		flat_pipelines->emplace_back(d.pipeline);
+	}
+	pipelines = flat_pipelines;
+
+	for (auto const &c : scene.cameras) {
+		cameras.emplace_back(Camera{ index(c.transform), c.fovy, c.aspect, c.near });
+	}
+
+	for (auto const &l : scene.lights) {
+		lights.emplace_back(Light{ index(l.transform), l.type, l.energy, l.spot_fov });
+	}
+}
+
+std::string Scene::Flat::name(uint32_t i) const {
+	assert(i < name_ends.size());
+	uint32_t begin = (i == 0 ? 0 : name_ends[i-1]);
+	return std::string(names.begin() + begin, names.begin() + name_ends[i]);
+}
+
+uint32_t Scene::Flat::find(std::string const &name) const {
+	uint32_t begin = 0;
+	for (uint32_t i = 0; i < uint32_t(name_ends.size()); ++i) {
+		uint32_t end = name_ends[i];
+		if (end - begin == name.size() && std::equal(name.begin(), name.end(), names.begin() + begin)) return i;
+		begin = end;
+	}
+	return -1U;
+}
+
+void Scene::Flat::update_world() const {
+	local_to_world.resize(positions.size());
+	for (uint32_t i = 0; i < uint32_t(positions.size()); ++i) {
+		//(same arithmetic as Transform::make_local_to_world, so results are identical)
+		glm::mat4x3 local_to_parent = make_local_to_parent(positions[i], rotations[i], scales[i]);
+		if (parents[i] == -1U) {
+			local_to_world[i] = local_to_parent;
+		} else {
+			assert(parents[i] < i);
+			local_to_world[i] = local_to_world[parents[i]] * glm::mat4(local_to_parent);
+		}
+	}
+}
+
+void Scene::Flat::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	update_world();
+
+	std::vector< QueuedDraw > queue;
+	if (!drawables.empty()) {
+		assert(pipelines && pipelines->size() == drawables.size());
+		queue.reserve(drawables.size());
+		for (uint32_t i = 0; i < uint32_t(drawables.size()); ++i) {
+			queue_draw(&queue, (*pipelines)[i], local_to_world[drawables[i]]);
+		}
 	}
+	draw_stats = draw_queue(&queue, world_to_clip, world_to_light);
+
+	GL_ERRORS();
 }
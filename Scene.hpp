@@ -42,6 +42,10 @@ struct Scene {
 		// ..relative to the world:
 		glm::mat4x3 make_local_to_world() const;
 		glm::mat4x3 make_world_to_local() const;
+		//(Scene::update_world() and Scene::world_matrix() cache local-to-world matrices for a whole scene)
+
+		//slot in the owning scene's world-matrix cache (-1U => not cached yet):
+		mutable uint32_t world_index = -1U;
 
 		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
 		Transform(Transform const &) = delete;
@@ -122,12 +126,68 @@ struct Scene {
 	std::list< Camera > cameras;
 	std::list< Light > lights;
 
+	//World matrices, cached so that each one is computed once per change:
+	// update_world() brings the cache up to date with 'transforms' (noticing added, removed, and re-parented transforms)
+	// and recomputes the matrix of every transform whose position, rotation, or scale (or whose ancestor's) changed;
+	// world_matrix() returns one transform's matrix, recomputing it and its ancestors' first if needed
+	// (so looking up a few transforms doesn't pay for all of them).
+	// n.b. world_matrix() falls back to a full update_world() for a transform added or re-parented since the last one; parents must be in the same scene
+	void update_world() const;
+	glm::mat4x3 const &world_matrix(Transform const &transform) const;
+	//(helpers for the above: is 'world' in the same order as 'transforms'? has the 'i'th matrix gone stale? recompute it:)
+	bool world_order_current() const;
+	bool world_changed(uint32_t i) const;
+	void world_compute(uint32_t i) const;
+
+	struct World {
+		//every transform in 'transforms', parents before children:
+		std::vector< Transform const * > order;
+		std::vector< uint32_t > parents; //index in 'order' of each one's parent (-1U => none)
+		//position, rotation, and scale the matrix was computed from:
+		struct Local {
+			glm::vec3 position;
+			glm::quat rotation;
+			glm::vec3 scale;
+		};
+		std::vector< Local > locals;
+		//the cached matrices:
+		std::vector< glm::mat4x3 > local_to_world;
+		//when each matrix was computed, and what its parent's stamp was then (=> a different parent stamp means the parent changed):
+		std::vector< uint64_t > stamps;
+		std::vector< uint64_t > parent_stamps;
+		uint64_t computed = 0; //number of matrices computed so far (also the latest stamp)
+	};
+	mutable World world;
+
+	//Transforms by name (the first transform with each name), e.g., for binding game code to a loaded scene:
+	// the index is built by load() and shared by copies, so a lookup costs the same however large the scene is.
+	// n.b. index_names() must be called again after adding, removing, or renaming transforms; lookups don't detect a stale index
+	// (except by the number of transforms, in which case they search 'transforms', as they do without an index)
+	Transform *find_transform(std::string const &name);
+	Transform const *find_transform(std::string const &name) const;
+	//..several at once, in the same order as 'names' (throws if any is missing):
+	std::vector< Transform * > find_transforms(std::vector< std::string > const &names);
+	void index_names();
+
+	std::shared_ptr< std::unordered_map< std::string, uint32_t > const > name_positions; //name => position in 'transforms'
+	std::vector< Transform * > by_position; //every transform, in 'transforms' order (as of the last index_names() or copy)
+
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
+	// (drawables are sorted by program, then vertex array, then textures, so that state only changes between draws that need it to)
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
 	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
 
+	//what the last draw() sent to OpenGL:
+	struct DrawStats {
+		uint32_t draws = 0; //glDrawArrays calls
+		uint32_t programs = 0; //glUseProgram calls
+		uint32_t vaos = 0; //glBindVertexArray calls
+		uint32_t textures = 0; //glBindTexture calls (binding and un-binding)
+	};
+	mutable DrawStats draw_stats;
+
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
 	// throws on file format errors
@@ -146,8 +206,64 @@ struct Scene {
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
 
 	//copy a scene (with proper pointer fixup):
+	// (reuses this scene's existing transforms, and is fastest when the other scene's world matrices are current, e.g., after update_world() or load())
 	Scene(Scene const &); //...as a constructor
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
 	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
+
+	//A "Flat" scene holds a scene's transforms (and what's attached to them) in contiguous arrays that refer to transforms by index,
+	// so copying one is a few memcpy's (no pointer fixup) and walking it doesn't chase pointers around the heap:
+
+	//	Scene::Flat flat(scene); //flatten (the Scene can be discarded afterward)
+	//	Scene::Flat copy = flat;
+	//	uint32_t red = copy.find("RedHamster");
+	//	copy.positions[red] += glm::vec3(1.0f, 0.0f, 0.0f);
+	//	copy.draw(world_to_clip);
+
+	struct Flat {
+		Flat() = default;
+		explicit Flat(Scene const &scene);
+
+		//transform 'i' is (positions[i], rotations[i], scales[i]) relative to parents[i] (-1U => none);
+		// parents always come before their children, and indices never change (so they work as handles, including in copies)
+		std::vector< glm::vec3 > positions;
+		std::vector< glm::quat > rotations;
+		std::vector< glm::vec3 > scales;
+		std::vector< uint32_t > parents;
+
+		//transform names, back to back: transform i's name is names[name_ends[i-1] (or 0), name_ends[i])
+		std::vector< char > names;
+		std::vector< uint32_t > name_ends;
+		std::string name(uint32_t i) const;
+		//index of the first transform named 'name' (-1U => none):
+		uint32_t find(std::string const &name) const;
+
+		//drawable i draws pipelines[i] at transform drawables[i]:
+		// (pipelines are shared by all copies, since they hold OpenGL objects and callbacks that copies can't change)
+		std::vector< uint32_t > drawables;
+		std::shared_ptr< std::vector< Drawable::Pipeline > const > pipelines;
+
+		struct Camera {
+			uint32_t transform;
+			float fovy, aspect, near; //(as in Scene::Camera)
+		};
+		std::vector< Camera > cameras;
+
+		struct Light {
+			uint32_t transform;
+			Scene::Light::Type type;
+			glm::vec3 energy;
+			float spot_fov;
+		};
+		std::vector< Light > lights;
+
+		//every transform's local-to-world matrix, computed in one pass by update_world():
+		mutable std::vector< glm::mat4x3 > local_to_world;
+		void update_world() const;
+
+		//draw every drawable (calls update_world() first; sorted as in Scene::draw):
+		void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
+		mutable DrawStats draw_stats;
+	};
 };
@@ -95,8 +95,9 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 
 	{ //decorate with some lines:
 		DrawLines draw_lines(scene_camera->make_projection() * glm::mat4(scene_camera->transform->make_world_to_local()));
+		//(draw() just updated the scene's world matrices)
 		for (auto &transform : scene.transforms) {
-			glm::mat4 local_to_world = transform.make_local_to_world();
+			glm::mat4 local_to_world = scene.world_matrix(transform);
 			auto xf = [&local_to_world](glm::vec3 const &vec) {
 				return glm::vec3(local_to_world * glm::vec4(vec, 1.0f));
 			};
@@ -106,7 +107,7 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 
 			if (transform.parent) {
 				//connect to parent:
-				glm::vec3 p = glm::vec3(transform.parent->make_local_to_world()[3]);
+				glm::vec3 p = glm::vec3(scene.world_matrix(*transform.parent)[3]);
 				draw_lines.draw(p, xf(glm::vec3(0.0f)), glm::u8vec4(0xff, 0xff, 0x00, 0xff));
 			}
 
@@ -136,4 +137,24 @@ void ShowSceneMode::draw(glm::uvec2 const &drawable_size) {
 		*/
 	}
 
+	{ //report the OpenGL state changes the scene took to draw:
+		glDisable(GL_DEPTH_TEST);
+		float aspect = scene_camera->aspect;
+		DrawLines draw_lines(glm::mat4(
+			1.0f / aspect, 0.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f
+		));
+
+		Scene::DrawStats const &stats = scene.draw_stats;
+		constexpr float H = 0.06f;
+		draw_lines.draw_text(std::to_string(stats.draws) + " draws: " + std::to_string(stats.programs) + " programs, "
+			+ std::to_string(stats.vaos) + " vertex arrays, " + std::to_string(stats.textures) + " texture binds",
+			glm::vec3(-aspect + 0.5f * H, -1.0f + 0.5f * H, 0.0f),
+			glm::vec3(H, 0.0f, 0.0f),
+			glm::vec3(0.0f, H, 0.0f),
+			glm::u8vec4(0xff, 0xff, 0xff, 0xff)
+		);
+	}
 }
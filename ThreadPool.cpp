@@ -0,0 +1,101 @@
+#include "ThreadPool.hpp"
+
+#include <cassert>
+
+ThreadPool::ThreadPool(uint32_t workers) {
+	for (uint32_t i = 0; i <= workers; ++i) {
+		deques.emplace_back(std::make_unique< Deque >());
+	}
+	threads.reserve(workers);
+	for (uint32_t i = 0; i < workers; ++i) {
+		threads.emplace_back(&ThreadPool::worker, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		quit = true;
+	}
+	work_available.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::submit(std::function< void() > job) {
+	Deque &deque = *deques[next_deque];
+	next_deque = (next_deque + 1) % uint32_t(deques.size());
+
+	pending.fetch_add(1, std::memory_order_acq_rel);
+	{
+		std::unique_lock< std::mutex > lock(deque.mutex);
+		deque.jobs.emplace_back(std::move(job));
+	}
+	{ //(counted under sleep_mutex, so a worker can't check for work, miss this job, and then sleep through the notify)
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		queued.fetch_add(1, std::memory_order_acq_rel);
+	}
+	work_available.notify_one();
+}
+
+bool ThreadPool::run_one(uint32_t home) {
+	std::function< void() > job;
+	for (uint32_t i = 0; i < uint32_t(deques.size()) && !job; ++i) {
+		Deque &deque = *deques[(home + i) % deques.size()];
+		std::unique_lock< std::mutex > lock(deque.mutex);
+		if (deque.jobs.empty()) continue;
+		if (i == 0) {
+			//own deque: newest first
+			job = std::move(deque.jobs.back());
+			deque.jobs.pop_back();
+		} else {
+			//stealing: oldest first
+			job = std::move(deque.jobs.front());
+			deque.jobs.pop_front();
+		}
+	}
+	if (!job) return false;
+	queued.fetch_sub(1, std::memory_order_acq_rel);
+
+	try {
+		job();
+	} catch (...) {
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		if (!failure) failure = std::current_exception();
+	}
+
+	if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		all_done.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::worker(uint32_t index) {
+	while (true) {
+		if (run_one(index)) continue;
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		work_available.wait(lock, [this](){
+			return quit || queued.load(std::memory_order_acquire) != 0;
+		});
+		if (quit) return;
+	}
+}
+
+void ThreadPool::wait() {
+	uint32_t home = uint32_t(deques.size()) - 1;
+	while (!idle()) {
+		if (run_one(home)) continue;
+		//everything left is running on a worker:
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		all_done.wait(lock, [this](){ return idle(); });
+	}
+
+	std::exception_ptr thrown;
+	{
+		std::unique_lock< std::mutex > lock(sleep_mutex);
+		std::swap(thrown, failure);
+	}
+	if (thrown) std::rethrow_exception(thrown);
+}
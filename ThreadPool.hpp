@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * ThreadPool runs batches of independent jobs (e.g., stepping each of many matches) on worker threads:
+
+	ThreadPool pool(3); //three workers (plus whichever thread calls wait())
+	for (Match &match : matches) {
+		pool.submit([&match](){ step(match); });
+	}
+	//...do other work while the jobs run...
+	pool.wait(); //helps run jobs until every submitted job has finished
+
+ * Jobs are dealt round-robin into per-thread deques. Each thread takes jobs from the back of its own
+ * deque and, once that is empty, steals from the front of the others', so a few slow jobs don't leave
+ * the other threads idle.
+ *
+ * submit() and wait() must be called from one thread (the one that owns the pool).
+ * If a job throws, the first exception is rethrown from wait().
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ThreadPool {
+	//start 'workers' worker threads (0 => jobs only run inside wait(), on the calling thread):
+	explicit ThreadPool(uint32_t workers);
+	~ThreadPool();
+
+	ThreadPool(ThreadPool const &) = delete;
+	ThreadPool &operator=(ThreadPool const &) = delete;
+
+	//queue a job:
+	void submit(std::function< void() > job);
+
+	//has every submitted job finished?
+	bool idle() const { return pending.load(std::memory_order_acquire) == 0; }
+
+	//run jobs on this thread too until every submitted job has finished:
+	void wait();
+
+	uint32_t worker_count() const { return uint32_t(threads.size()); }
+
+	//internals:
+	struct Deque {
+		std::mutex mutex;
+		std::deque< std::function< void() > > jobs;
+	};
+	std::vector< std::unique_ptr< Deque > > deques; //one per worker, plus one (the last) for the thread that calls wait()
+	std::vector< std::thread > threads;
+	uint32_t next_deque = 0; //submit() deals jobs out round-robin
+
+	std::atomic< uint32_t > queued{0}; //jobs in deques
+	std::atomic< uint32_t > pending{0}; //jobs submitted but not finished
+	std::mutex sleep_mutex; //guards quit and the two condition variables' waits
+	std::condition_variable work_available; //workers sleep on this
+	std::condition_variable all_done; //wait() sleeps on this
+	bool quit = false;
+
+	std::exception_ptr failure; //first exception thrown by a job (guarded by sleep_mutex)
+
+	//run one job, from deque 'home' or (failing that) stolen from another; returns 'false' if there were none:
+	bool run_one(uint32_t home);
+	void worker(uint32_t index);
+};
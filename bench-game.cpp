@@ -0,0 +1,118 @@
+//bench-game: how long Game::update takes, over many ticks of scripted play.
+// build with: node Maekfile.js dist/bench-game
+// run with:   dist/bench-game [--ticks <count>]
+//
+// Both hamsters are driven like simple bots (face the other hamster, charge, jab when close, back off),
+// so the run keeps exercising collisions, lance hits, and games ending and being reset.
+
+#include "Game.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+//controls for player 'i' on tick 't', facing the other hamster and taking turns charging and backing off:
+Player::Controls bot_controls(Game const &game, uint32_t i, uint32_t t) {
+	Player const &self = game.players[i];
+	Player const &other = game.players[1 - i];
+
+	Player::Controls controls;
+	bool charge = (t % 120 < 75);
+	controls.up.pressed = charge;
+	controls.down.pressed = !charge;
+
+	//'up' moves along the hamster's local -y:
+	glm::vec3 forward = self.rotation * glm::vec3(0.0f, -1.0f, 0.0f);
+	glm::vec3 to_other = other.position - self.position;
+	float angle = std::atan2(forward.x * to_other.y - forward.y * to_other.x, forward.x * to_other.x + forward.y * to_other.y);
+	//(move_player turns by -3 * mouse_x radians; turn at most 0.15 radians per command)
+	controls.mouse_x = std::max(-0.05f, std::min(0.05f, -angle / 3.0f));
+
+	if (self.since_attack == 0.0f && glm::length2(to_other) < 7.0f * 7.0f) controls.LMB.downs = 1;
+	return controls;
+}
+
+int main(int argc, char **argv) {
+	uint32_t ticks = 1000000;
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--ticks" && i + 1 < argc) {
+			ticks = uint32_t(std::stoul(argv[++i]));
+			if (ticks == 0) usage = true;
+		} else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		std::cerr << "Usage:\n\t./bench-game [--ticks <count>]" << std::endl;
+		return 1;
+	}
+
+	//two commands (60Hz client frames) per tick:
+	const uint32_t CommandsPerTick = 2;
+
+	Game game;
+	std::vector< float > times; //per tick, in seconds
+	times.reserve(ticks);
+	uint32_t hits = 0, contacts = 0, games = 0;
+	std::array< uint32_t, 2 > seq = {0, 0};
+
+	//(spawn_player and Game::update print every ready-up and hit; that's not what's being timed)
+	std::streambuf *old_out = std::cout.rdbuf(nullptr);
+	for (uint32_t t = 0; t < ticks; ++t) {
+		//(as server.cpp does once both players ready up)
+		if (game.game_state == Game::GameState::WaitingForPlayer) {
+			for (uint32_t i = 0; i < 2; ++i) {
+				game.spawn_player();
+				seq[i] = 0;
+			}
+			game.game_state = Game::GameState::InGame;
+			games += 1;
+		}
+		for (uint32_t i = 0; i < 2; ++i) {
+			Player::Controls controls = bot_controls(game, i, t);
+			game.players[i].controls.add(controls);
+			for (uint32_t c = 0; c < CommandsPerTick; ++c) {
+				game.queue_command(&game.players[i], controls.command(++seq[i], Game::Tick / CommandsPerTick));
+			}
+		}
+		int health = game.players[0].health + game.players[1].health;
+
+		auto before = std::chrono::high_resolution_clock::now();
+		game.update(Game::Tick);
+		auto after = std::chrono::high_resolution_clock::now();
+		times.emplace_back(std::chrono::duration< float >(after - before).count());
+
+		if (game.players[0].health + game.players[1].health < health) hits += 1;
+		if (glm::length2(game.players[1].position - game.players[0].position) < (2.0f * Game::PlayerRadius) * (2.0f * Game::PlayerRadius)) contacts += 1;
+	}
+	std::cout.rdbuf(old_out);
+
+	double total = 0.0;
+	for (float time : times) total += time;
+	std::sort(times.begin(), times.end());
+	auto percentile = [&](double p) {
+		return times[std::min(size_t(p * double(times.size())), times.size() - 1)];
+	};
+
+	std::cout << "Game::update at " << int(Game::TickRate) << "Hz, " << ticks << " ticks (" << games << " games, "
+	          << hits << " ticks with lance hits, " << contacts << " ticks with hamsters touching):" << std::endl;
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "  mean " << total / ticks * 1e9 << " ns/tick (" << ticks / total << " ticks/second)" << std::endl;
+	std::cout << "  p50 " << percentile(0.5) * 1e9 << "  p90 " << percentile(0.9) * 1e9 << "  p99 " << percentile(0.99) * 1e9
+	          << "  p99.9 " << percentile(0.999) * 1e9 << "  max " << times.back() * 1e9 << " ns/tick" << std::endl;
+
+	//a run that never hit, touched, or finished a game isn't measuring what it's meant to:
+	if (hits == 0 || contacts == 0 || games < 2) {
+		std::cout << "FAILED: the scripted play didn't exercise lance hits, collisions, and game resets." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1123 @@
+//bench-net: micro-benchmarks for the networking layer (Connection.*pp).
+// build with: node Maekfile.js dist/bench-net
+// run with:   dist/bench-net [base port]
+
+#include "Connection.hpp"
+#include "MessageView.hpp"
+#include "Game.hpp"
+#include "ThreadPool.hpp"
+#include "Recording.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <iomanip>
+#include <list>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+//run 'fn' with std::cout and std::cerr silenced (Server/Client are chatty about every connection):
+template< typename F >
+void quietly(F const &fn) {
+	std::streambuf *old_out = std::cout.rdbuf(nullptr);
+	std::streambuf *old_err = std::cerr.rdbuf(nullptr);
+	fn();
+	std::cout.rdbuf(old_out);
+	std::cerr.rdbuf(old_err);
+}
+
+//move the bytes queued in a connection's send_buffer into a Buffer, as the other end would receive them:
+Connection::Buffer take_sent(Connection &connection) {
+	Connection::Buffer sent;
+	connection.send_buffer.for_each_piece([&](uint8_t const *data, size_t size) {
+		sent.append(data, size);
+		return true;
+	});
+	connection.send_buffer.clear();
+	return sent;
+}
+
+//---------------------------------------------------
+//poll: cost of one Server::poll() that delivers a single message when 'count' connections are open but idle.
+
+double bench_poll(Server::Backend backend, uint32_t count, std::string const &port, uint32_t iterations) {
+	std::unique_ptr< Server > server;
+	std::vector< std::unique_ptr< Client > > clients;
+
+	quietly([&](){
+		server = std::make_unique< Server >(port, backend);
+		clients.reserve(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			clients.emplace_back(std::make_unique< Client >("localhost", port));
+			//accept as we go so the listen backlog doesn't fill up:
+			server->poll(nullptr, 0.0);
+		}
+		while (server->connections.size() < count) {
+			server->poll(nullptr, 0.01);
+		}
+	});
+
+	//(the first client, since its socket has a low number: Client::poll uses select(), which only takes sockets below FD_SETSIZE)
+	Client &active = *clients.front();
+
+	double total = 0.0;
+	for (uint32_t iter = 0; iter < iterations; ++iter) {
+		active.connection.send(uint8_t(iter));
+		active.poll(nullptr, 0.0);
+
+		bool got = false;
+		while (!got) {
+			auto before = std::chrono::high_resolution_clock::now();
+			server->poll([&](Connection *c, Connection::Event evt){
+				if (evt == Connection::OnRecv) {
+					got = true;
+					c->recv_buffer.clear();
+				}
+			}, 0.0);
+			auto after = std::chrono::high_resolution_clock::now();
+			total += std::chrono::duration< double >(after - before).count();
+		}
+	}
+
+	//Server and Client don't own their sockets' lifetimes, so close everything explicitly:
+	for (auto &c : server->connections) {
+		c.close();
+	}
+	for (auto &client : clients) {
+		client->connection.close();
+	}
+
+	return total / iterations;
+}
+
+//---------------------------------------------------
+//state bytes: S2C_State bytes sent to one client over a scripted match, full snapshots vs. deltas from acknowledged snapshots.
+
+//scripted match phases (ticks at 30Hz):
+enum Phase { Lobby, Play, Idle, PhaseCount };
+static const char *PhaseNames[PhaseCount] = { "lobby", "play", "idle" };
+static const uint32_t PhaseTicks[PhaseCount] = { 90, 300, 150 }; //3s waiting for players, 10s of play, 5s standing still
+
+struct StateBytes {
+	size_t full[PhaseCount] = {0, 0, 0}; //bytes if every tick sends a full snapshot
+	size_t delta[PhaseCount] = {0, 0, 0}; //bytes with deltas (including the client's acks)
+};
+
+//'ack_delay' is the number of ticks between the server sending a snapshot and receiving the client's ack of it.
+//NOTE: Game::reset_hamsters() only looks up transforms for the first Game constructed,
+// so the same Games are reused (and reset) for every run.
+StateBytes bench_state_bytes(Game &server, Game &client, Game &sent, StateFormat format, uint32_t ack_delay) {
+	quietly([&](){
+		server.reset_game();
+	});
+	client.received_snapshots.clear();
+
+	Connection full_connection, delta_connection, ack_connection;
+	Game::StateHistory history;
+	history.format = format;
+	std::deque< std::vector< uint8_t > > acks_in_flight; //acks sent on each of the last 'ack_delay' ticks
+
+	//the client's decoded state should match the snapshot the server recorded as sent (i.e., after any quantization),
+	// so compare raw full snapshots of both, after the header, role, applied command, format, and seq:
+	auto check_decoded = [&]() {
+		sent.apply_snapshot(*history.unacked.back());
+		Connection expected, got;
+		sent.send_state_message(&expected);
+		client.send_state_message(&got);
+		const size_t Skip = MessageView::HeaderSize + sizeof(PlayerType) + sizeof(uint32_t) + sizeof(StateFormat) + sizeof(uint32_t);
+		Connection::Buffer a = take_sent(expected), b = take_sent(got);
+		if (a.size() != b.size() || std::memcmp(a.data() + Skip, b.data() + Skip, b.size() - Skip) != 0) {
+			throw std::runtime_error("Decoded state doesn't match sent state on tick " + std::to_string(server.tick) + ".");
+		}
+	};
+
+	StateBytes bytes;
+	for (uint32_t phase = 0; phase < PhaseCount; ++phase) {
+		if (phase == Play) {
+			quietly([&](){
+				server.spawn_player();
+				server.spawn_player();
+			});
+			server.game_state = Game::GameState::InGame;
+		}
+		for (uint32_t t = 0; t < PhaseTicks[phase]; ++t) {
+			for (uint32_t i = 0; i < 2; ++i) {
+				Player::Controls &controls = server.players[i].controls;
+				bool playing = (phase == Play);
+				controls.up.pressed = playing && (i == 0 || (t / 45) % 2 == 0);
+				controls.left.pressed = playing && i == 1;
+				controls.jump.pressed = playing && (t / 60) % 2 == 1;
+				controls.LMB.downs = (playing && t % 50 == 10 * i) ? 1 : 0;
+				controls.mouse_x = playing ? 0.01f * std::sin(0.05f * float(t)) : 0.0f;
+				//(one movement command per tick, as if from a client running at the tick rate)
+				server.queue_command(&server.players[i], controls.command(server.tick + 1, Game::Tick));
+			}
+			quietly([&](){
+				server.update(Game::Tick); //(prints hits)
+			});
+
+			//acks arriving this tick:
+			if (acks_in_flight.size() > ack_delay) {
+				std::vector< uint8_t > const &ack = acks_in_flight.front();
+				MessageView message;
+				for (size_t at = 0; MessageView::frame(ack.data() + at, ack.size() - at, &message); at += message.framed_size()) {
+					history.recv_ack_message(message);
+				}
+				acks_in_flight.pop_front();
+			}
+
+			server.send_state_message(&full_connection);
+			server.send_state_message(&delta_connection, nullptr, &history);
+			bytes.full[phase] += full_connection.send_buffer.size();
+			bytes.delta[phase] += delta_connection.send_buffer.size();
+			full_connection.send_buffer.clear();
+
+			//client decodes and acks:
+			Connection::Buffer delivered = take_sent(delta_connection);
+			dispatch_messages(delivered, [&](MessageView const &message) {
+				if (!client.recv_state_message(message)) {
+					throw std::runtime_error("Client lost delta baseline on tick " + std::to_string(server.tick) + ".");
+				}
+				client.send_state_ack_message(&ack_connection, client.received_snapshots.back().seq);
+				return true;
+			});
+			check_decoded();
+
+			bytes.delta[phase] += ack_connection.send_buffer.size();
+			Connection::Buffer ack = take_sent(ack_connection);
+			acks_in_flight.emplace_back(ack.begin(), ack.end());
+		}
+	}
+
+	return bytes;
+}
+
+//---------------------------------------------------
+//broadcast: server time per tick to send state to 'count' spectators that ack every snapshot,
+// encoding per connection (Game::send_state_message) vs. once per tick (Game::StateBroadcast).
+
+struct BroadcastTime {
+	double per_connection = 0.0; //seconds per tick
+	double shared = 0.0; //seconds per tick
+};
+
+BroadcastTime bench_broadcast(Game &server, Game &client, uint32_t count, StateFormat format, uint32_t ticks) {
+	std::vector< Connection > connections[2]; //[0] encodes per connection, [1] uses a StateBroadcast
+	std::vector< Game::StateHistory > histories[2];
+	for (uint32_t i = 0; i < 2; ++i) {
+		connections[i].resize(count);
+		histories[i].resize(count);
+		for (auto &history : histories[i]) history.format = format;
+	}
+
+	BroadcastTime time;
+	for (uint32_t t = 0; t < ticks; ++t) {
+		quietly([&](){
+			server.update(Game::Tick);
+		});
+
+		{
+			auto before = std::chrono::high_resolution_clock::now();
+			for (uint32_t c = 0; c < count; ++c) {
+				server.send_state_message(&connections[0][c], nullptr, &histories[0][c]);
+			}
+			auto after = std::chrono::high_resolution_clock::now();
+			time.per_connection += std::chrono::duration< double >(after - before).count();
+		}
+		{
+			auto before = std::chrono::high_resolution_clock::now();
+			Game::StateBroadcast broadcast(server);
+			for (uint32_t c = 0; c < count; ++c) {
+				broadcast.send_state_message(&connections[1][c], nullptr, &histories[1][c]);
+			}
+			auto after = std::chrono::high_resolution_clock::now();
+			time.shared += std::chrono::duration< double >(after - before).count();
+		}
+
+		//both paths should send exactly the same bytes:
+		for (uint32_t c = 0; c < count; ++c) {
+			Connection::Buffer a = take_sent(connections[0][c]);
+			Connection::Buffer b = take_sent(connections[1][c]);
+			if (a.size() != b.size() || std::memcmp(a.data(), b.data(), a.size()) != 0) {
+				throw std::runtime_error("Shared state broadcast doesn't match per-connection encoding.");
+			}
+		}
+
+		//every client acks the snapshot it just got:
+		Connection ack;
+		client.send_state_ack_message(&ack, server.tick);
+		MessageView message;
+		Connection::Buffer ack_bytes = take_sent(ack);
+		MessageView::frame(ack_bytes.data(), ack_bytes.size(), &message);
+		for (uint32_t i = 0; i < 2; ++i) {
+			for (auto &history : histories[i]) history.recv_ack_message(message);
+		}
+	}
+
+	time.per_connection /= ticks;
+	time.shared /= ticks;
+	return time;
+}
+
+//---------------------------------------------------
+//backed up: server send_buffer growth for a client that has stopped reading, with and without replacing queued state.
+
+struct BackedUp {
+	size_t queued = 0; //bytes left in the server's send_buffer
+	uint32_t dropped = 0; //state messages replaced before they were sent
+};
+
+BackedUp bench_backed_up(Game &server, bool replace_queued, size_t send_high_water, std::string const &port, uint32_t ticks) {
+	std::unique_ptr< Server > listener;
+	std::unique_ptr< Client > client;
+	quietly([&](){
+		listener = std::make_unique< Server >(port);
+		listener->send_high_water = send_high_water;
+		listener->send_limit = 0; //(so the connection isn't closed out from under the benchmark)
+		client = std::make_unique< Client >("localhost", port);
+		while (listener->connections.empty()) {
+			listener->poll(nullptr, 0.01);
+		}
+	});
+	Connection &connection = listener->connections.front();
+
+	BackedUp result;
+	for (uint32_t t = 0; t < ticks; ++t) {
+		Game::StateBroadcast broadcast(server);
+		broadcast.replace_queued = replace_queued;
+		broadcast.send_state_message(&connection);
+		result.dropped += broadcast.dropped;
+		listener->poll(nullptr, 0.0); //client never polls, so its socket fills up
+	}
+	result.queued = connection.send_buffer.size();
+
+	connection.close();
+	client->connection.close();
+	return result;
+}
+
+//---------------------------------------------------
+//exchange: a 30Hz exchange on loopback through a simulated bad link (see Impairment in Connection.hpp).
+// Each tick, each end sends one reliable message (plus 'padding' bytes); the server also sends one replaceable "state" message.
+
+struct Exchange {
+	uint32_t reliable_sent = 0; //(each direction)
+	uint32_t reliable_received[2] = {0, 0}; //[0] by server, [1] by client; in order, or the exchange fails
+	uint32_t unreliable_sent = 0;
+	uint32_t unreliable_received = 0; //(never older than one already received, or the exchange fails)
+	double delay_total = 0.0; //sum of (client-received) reliable messages' one-way delays
+	double delay_max = 0.0;
+	double drain_time = 0.0; //seconds after the last tick until every reliable message arrived
+};
+
+Exchange bench_exchange(Transport transport, Impairment const &impairment, uint32_t padding, std::string const &port, uint32_t ticks) {
+	std::unique_ptr< Server > server;
+	std::unique_ptr< Client > client;
+	quietly([&](){
+		server = std::make_unique< Server >(port, transport);
+		client = std::make_unique< Client >("localhost", port, transport);
+	});
+	server->impairment = client->impairment = impairment;
+
+	Exchange result;
+	uint32_t newest_state = 0;
+
+	auto now = []() {
+		return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+	};
+
+	//messages are |type|size (3)|counter (4)|time sent (8)|padding|, type 'r' for reliable and 's' for replaceable state:
+	auto message = [&](char type, uint32_t counter, uint32_t padding_) {
+		std::vector< uint8_t > bytes(MessageView::HeaderSize + 4 + 8 + padding_);
+		MessageView::write_header(bytes.data(), uint8_t(type), uint32_t(bytes.size() - MessageView::HeaderSize));
+		double sent = now();
+		std::memcpy(bytes.data() + MessageView::HeaderSize, &counter, 4);
+		std::memcpy(bytes.data() + MessageView::HeaderSize + 4, &sent, 8);
+		return bytes;
+	};
+	auto receive = [&](uint32_t end) {
+		return [&result, &newest_state, &now, end](Connection *c, Connection::Event evt) {
+			if (evt != Connection::OnRecv) return;
+			dispatch_messages(c->recv_buffer, [&](MessageView const &m) {
+				MessageView::Reader reader = m.reader();
+				uint32_t counter = reader.read< uint32_t >();
+				double sent = reader.read< double >();
+				if (m.type == 'r') {
+					if (counter != result.reliable_received[end]) throw std::runtime_error("Reliable message arrived out of order.");
+					result.reliable_received[end] += 1;
+					if (end == 1) {
+						result.delay_total += now() - sent;
+						result.delay_max = std::max(result.delay_max, now() - sent);
+					}
+				} else {
+					if (counter <= newest_state) throw std::runtime_error("Older state message arrived after a newer one.");
+					newest_state = counter;
+					result.unreliable_received += 1;
+				}
+				return true;
+			});
+		};
+	};
+	auto server_receive = receive(0);
+	auto client_receive = receive(1);
+
+	auto poll_until = [&](std::chrono::steady_clock::time_point until) {
+		do {
+			quietly([&](){
+				server->poll(server_receive, 0.001);
+				client->poll(client_receive, 0.0);
+			});
+		} while (std::chrono::steady_clock::now() < until);
+	};
+
+	//let the connection open so that both ends send every tick:
+	auto connecting = std::chrono::steady_clock::now();
+	while (server->connections.empty() && std::chrono::steady_clock::now() - connecting < std::chrono::seconds(10)) {
+		poll_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(1));
+	}
+	if (server->connections.empty()) throw std::runtime_error("Client never connected.");
+
+	auto next_tick = std::chrono::steady_clock::now();
+	for (uint32_t t = 0; t < ticks; ++t) {
+		next_tick += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(Game::Tick));
+		std::vector< uint8_t > reliable = message('r', result.reliable_sent, padding);
+		client->connection.send_raw(reliable.data(), reliable.size());
+		for (auto &c : server->connections) {
+			c.send_raw(reliable.data(), reliable.size());
+			auto state = std::make_shared< std::vector< uint8_t > const >(message('s', t + 1, 0));
+			c.send_shared(nullptr, 0, state, Game::StateBroadcast::StateSegmentTag);
+			result.unreliable_sent += 1;
+		}
+		result.reliable_sent += 1;
+		poll_until(next_tick);
+	}
+
+	auto before = std::chrono::steady_clock::now();
+	while ((result.reliable_received[0] < result.reliable_sent || result.reliable_received[1] < result.reliable_sent)
+	    && std::chrono::steady_clock::now() - before < std::chrono::seconds(10)) {
+		poll_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(1));
+	}
+	result.drain_time = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+
+	quietly([&](){
+		for (auto &c : server->connections) c.close();
+		client->connection.close();
+	});
+	return result;
+}
+
+//---------------------------------------------------
+//prediction: client-side prediction error for a scripted run over loopback.
+// The client sends one movement command per 60Hz frame and predicts its hamster; the server ticks at 30Hz.
+// Nothing else pushes the hamster around, so with raw state the prediction should match the server exactly.
+
+struct PredictionError {
+	float max = 0.0f; //largest error reported by any state message
+	float final = 0.0f; //error once input has stopped and every command has been applied by the server
+	size_t max_replayed = 0; //most commands re-applied on top of one state message (~ round trip, in frames)
+};
+
+PredictionError bench_prediction(Game &server_game, Game &client_game, StateFormat format, Impairment const &impairment, std::string const &port) {
+	const float Frame = 1.0f / 60.0f;
+	const float InputTime = 3.0f; //seconds of scripted input (then nothing, so the hamster drifts to a stop)
+	const float RunTime = 4.0f;
+
+	std::unique_ptr< Server > server;
+	std::unique_ptr< Client > client;
+	Player *player = nullptr;
+	quietly([&](){
+		server = std::make_unique< Server >(port);
+		client = std::make_unique< Client >("localhost", port);
+		server_game.reset_game();
+		player = server_game.spawn_player();
+		server_game.spawn_player();
+	});
+	server_game.game_state = Game::GameState::InGame;
+	server->impairment = client->impairment = impairment;
+
+	client_game.received_snapshots.clear();
+	client_game.predicted.clear();
+	client_game.next_command_seq = 1;
+	client_game.player_type = Spectator;
+
+	Game::StateHistory history;
+	history.format = format;
+
+	PredictionError error;
+
+	auto server_receive = [&](Connection *c, Connection::Event evt) {
+		if (evt != Connection::OnRecv) return;
+		dispatch_messages(c->recv_buffer, [&](MessageView const &message) {
+			if (message.type == uint8_t(Message::C2S_Controls)) {
+				server_game.queue_command(player, player->controls.recv_controls_message(message));
+			} else if (message.type == uint8_t(Message::C2S_StateAck)) {
+				history.recv_ack_message(message);
+			}
+			return true;
+		});
+	};
+	auto client_receive = [&](Connection *c, Connection::Event evt) {
+		if (evt != Connection::OnRecv) return;
+		dispatch_messages(c->recv_buffer, [&](MessageView const &message) {
+			if (!client_game.recv_state_message(message)) throw std::runtime_error("Client lost delta baseline.");
+			client_game.send_state_ack_message(c, client_game.received_snapshots.back().seq);
+			error.max = std::max(error.max, client_game.prediction_error);
+			error.max_replayed = std::max(error.max_replayed, client_game.predicted.size());
+			return true;
+		});
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	auto since_start = [&]() {
+		return std::chrono::duration< float >(std::chrono::steady_clock::now() - start).count();
+	};
+	float next_frame = 0.0f;
+	float next_tick = Game::Tick;
+	Player::Controls controls;
+	while (since_start() < RunTime || (!client_game.predicted.empty() && since_start() < RunTime + 5.0f)) {
+		float t = since_start();
+		if (t >= next_frame) {
+			next_frame += Frame;
+			//scripted input: forward, then forward while turning, then sideways, then nothing:
+			controls.up.pressed = (t < 2.0f);
+			controls.left.pressed = (t >= 1.0f && t < 2.0f);
+			controls.right.pressed = (t >= 2.0f && t < InputTime);
+			controls.mouse_x = (t >= 1.0f && t < 2.0f ? 0.01f : 0.0f);
+			bool playing = (client_game.player_type == RedHamster || client_game.player_type == BlueHamster)
+				&& client_game.game_state == Game::GameState::InGame;
+			if (playing && t < RunTime) client_game.send_predicted_controls(&client->connection, controls, Frame);
+		}
+		if (t >= next_tick) {
+			next_tick += Game::Tick;
+			quietly([&](){
+				server_game.update(Game::Tick);
+			});
+			for (auto &c : server->connections) {
+				server_game.send_state_message(&c, player, &history);
+			}
+		}
+		quietly([&](){
+			server->poll(server_receive, 0.001);
+			client->poll(client_receive, 0.0);
+		});
+	}
+	error.final = client_game.prediction_error;
+
+	quietly([&](){
+		for (auto &c : server->connections) c.close();
+		client->connection.close();
+	});
+	return error;
+}
+
+//---------------------------------------------------
+//quantization error: largest differences between random states and the same states after a StateFormat::Quantized round trip.
+
+struct RoundTripError {
+	float position = 0.0f; //distance
+	float lance_position = 0.0f; //distance
+	float velocity = 0.0f; //relative to the velocity's length (or absolute, below 1 unit/s)
+	float rotation = 0.0f; //angle (radians)
+};
+
+RoundTripError bench_round_trip(Game &server, Game &client, uint32_t samples) {
+	std::mt19937 mt(0x15466);
+	auto rand = [&](float min, float max) {
+		return std::uniform_real_distribution< float >(min, max)(mt);
+	};
+	auto rand_rotation = [&]() {
+		return glm::normalize(glm::quat(rand(-1.0f, 1.0f), rand(-1.0f, 1.0f), rand(-1.0f, 1.0f), rand(-1.0f, 1.0f)));
+	};
+	auto angle = [](glm::quat const &a, glm::quat const &b) {
+		return 2.0f * std::acos(std::min(1.0f, std::abs(glm::dot(a, b))));
+	};
+
+	RoundTripError error;
+	for (uint32_t sample = 0; sample < samples; ++sample) {
+		for (Player &p : server.players) {
+			p.position = glm::vec3(rand(Game::ArenaMin.x, Game::ArenaMax.x), rand(Game::ArenaMin.y, Game::ArenaMax.y), rand(0.0f, 4.0f));
+			p.lance_position = glm::vec3(rand(-4.0f, 4.0f), rand(-4.0f, 4.0f), rand(-4.0f, 4.0f));
+			p.velocity = glm::vec3(rand(-Game::PlayerSpeed, Game::PlayerSpeed), rand(-Game::PlayerSpeed, Game::PlayerSpeed), 0.0f);
+			p.rotation = rand_rotation();
+			p.lance_rotation = rand_rotation();
+			p.wheel_rotation = rand_rotation();
+		}
+
+		Connection connection;
+		Game::StateHistory history;
+		history.format = StateFormat::Quantized;
+		server.send_state_message(&connection, nullptr, &history);
+		Connection::Buffer delivered = take_sent(connection);
+		dispatch_messages(delivered, [&](MessageView const &message) {
+			client.recv_state_message(message);
+			return true;
+		});
+
+		for (uint32_t i = 0; i < 2; ++i) {
+			Player const &a = server.players[i];
+			Player const &b = client.players[i];
+			error.position = std::max(error.position, glm::length(a.position - b.position));
+			error.lance_position = std::max(error.lance_position, glm::length(a.lance_position - b.lance_position));
+			error.velocity = std::max(error.velocity, glm::length(a.velocity - b.velocity) / std::max(1.0f, glm::length(a.velocity)));
+			error.rotation = std::max(error.rotation, angle(a.rotation, b.rotation));
+			error.rotation = std::max(error.rotation, angle(a.lance_rotation, b.lance_rotation));
+			error.rotation = std::max(error.rotation, angle(a.wheel_rotation, b.wheel_rotation));
+		}
+	}
+	return error;
+}
+
+//---------------------------------------------------
+//lag compensation: a scripted jab by red at a blue hamster that is far away on the server,
+// but that red's client (going by its acknowledged snapshots) was drawing right at the lance tip.
+//returns the damage blue took.
+
+int bench_rewound_jab(Game &game, float max_rewind) {
+	const uint32_t Ticks = 15;
+	auto start = [&]() {
+		quietly([&](){
+			game.reset_game();
+			game.spawn_player();
+			game.spawn_player();
+		});
+		game.game_state = Game::GameState::InGame;
+		game.players[1].position = glm::vec3(Game::ArenaMax - glm::vec2(Game::PlayerRadius), game.players[1].position.z);
+		game.players[0].controls.LMB.downs = 1;
+	};
+
+	//where red's lance tip goes during the jab (nothing is close enough to hit):
+	std::vector< glm::vec3 > tips;
+	start();
+	for (uint32_t t = 0; t < Ticks; ++t) {
+		quietly([&](){ game.update(Game::Tick); });
+		Scene::Transform *tip = game.lance_tip_transform[0];
+		tips.emplace_back(tip->make_local_to_world() * glm::vec4(tip->position, 1.0f));
+	}
+
+	//the same jab, with red's view of blue at the tip:
+	start();
+	float old_max_rewind = game.max_rewind;
+	game.max_rewind = max_rewind;
+	int health = game.players[1].health;
+	for (uint32_t t = 0; t < Ticks; ++t) {
+		game.set_view(&game.players[0], game.tick); //acked the latest snapshot
+		uint32_t view = game.view_tick[0];
+		if (view > 1) {
+			for (uint32_t v : {view - 1, view}) {
+				Game::PastTick &past = game.past_ticks[v % game.past_ticks.size()];
+				past.tick = v;
+				past.position = { game.players[0].position, tips[t] };
+			}
+		}
+		quietly([&](){ game.update(Game::Tick); });
+	}
+	game.view_tick = {0, 0};
+	game.max_rewind = old_max_rewind;
+	return health - game.players[1].health;
+}
+
+//scripted input for player 'i' of match 'm' on tick 't' (different for each match and player):
+Player::Controls scripted_controls(uint32_t t, uint32_t m, uint32_t i) {
+	Player::Controls controls;
+	uint32_t phase = (t + 7 * m + 13 * i) % 90;
+	controls.up.pressed = (phase < 45);
+	controls.left.pressed = (phase >= 30 && phase < 60);
+	controls.jump.pressed = (phase >= 60 && phase < 80);
+	controls.mouse_x = (phase < 20 ? 0.01f : 0.0f);
+	controls.LMB.downs = (phase == 50 ? 1 : 0);
+	return controls;
+}
+
+//---------------------------------------------------
+//matches: server time per tick to step 'count' independent matches (as server.cpp hosts them) on a ThreadPool,
+// each with two players sending one command per tick and acking every (quantized) snapshot.
+
+double bench_matches(Game &client, ThreadPool &pool, uint32_t count, uint32_t ticks) {
+	struct Match {
+		Game game;
+		Connection connections[2];
+		Game::StateHistory histories[2];
+	};
+	std::list< Match > matches;
+	quietly([&](){
+		for (uint32_t m = 0; m < count; ++m) {
+			matches.emplace_back();
+			Match &match = matches.back();
+			match.game.spawn_player();
+			match.game.spawn_player();
+			match.game.game_state = Game::GameState::InGame;
+			for (auto &history : match.histories) history.format = StateFormat::Quantized;
+		}
+	});
+
+	double time = 0.0;
+	uint32_t seq = 0;
+	for (uint32_t t = 0; t < ticks; ++t) {
+		uint32_t m = 0;
+		for (Match &match : matches) {
+			for (uint32_t i = 0; i < 2; ++i) {
+				Player::Controls controls = scripted_controls(t, m, i);
+				match.game.players[i].controls.add(controls);
+				match.game.queue_command(&match.game.players[i], controls.command(seq + 1, Game::Tick));
+			}
+			m += 1;
+		}
+		seq += 1;
+
+		auto before = std::chrono::high_resolution_clock::now();
+		quietly([&](){
+			for (Match &match : matches) {
+				pool.submit([&match](){
+					match.game.update(Game::Tick);
+					Game::StateBroadcast broadcast(match.game);
+					for (uint32_t i = 0; i < 2; ++i) {
+						broadcast.send_state_message(&match.connections[i], &match.game.players[i], &match.histories[i]);
+					}
+				});
+			}
+			pool.wait();
+		});
+		auto after = std::chrono::high_resolution_clock::now();
+		time += std::chrono::duration< double >(after - before).count();
+
+		//every client acks the snapshot it just got:
+		for (Match &match : matches) {
+			Connection ack;
+			client.send_state_ack_message(&ack, match.game.tick);
+			MessageView message;
+			Connection::Buffer ack_bytes = take_sent(ack);
+			MessageView::frame(ack_bytes.data(), ack_bytes.size(), &message);
+			for (uint32_t i = 0; i < 2; ++i) {
+				take_sent(match.connections[i]);
+				match.histories[i].recv_ack_message(message);
+			}
+		}
+	}
+
+	return time / ticks;
+}
+
+//---------------------------------------------------
+//determinism: games given the same inputs must end up in exactly the same state,
+// whether stepped alone or alongside other games on a ThreadPool.
+//returns the number of ticks on which some game's state differed from the one stepped alone.
+
+uint32_t bench_determinism(uint32_t games, uint32_t ticks) {
+	std::list< Game > alone, pooled;
+	quietly([&](){
+		for (uint32_t g = 0; g <= games; ++g) {
+			Game &game = (g == 0 ? alone : pooled).emplace_back();
+			game.spawn_player();
+			game.spawn_player();
+			game.game_state = Game::GameState::InGame;
+		}
+	});
+
+	//the whole state, as raw (exact) bytes:
+	auto state = [](Game const &game) {
+		Connection connection;
+		game.send_state_message(&connection);
+		return take_sent(connection);
+	};
+
+	ThreadPool pool(3);
+	uint32_t differed = 0;
+	for (uint32_t t = 0; t < ticks; ++t) {
+		auto give_input = [&](Game &game) {
+			for (uint32_t i = 0; i < 2; ++i) {
+				Player::Controls controls = scripted_controls(t, 0, i);
+				game.players[i].controls.add(controls);
+				game.queue_command(&game.players[i], controls.command(t + 1, Game::Tick));
+			}
+		};
+		give_input(alone.front());
+		quietly([&](){ alone.front().update(Game::Tick); });
+		for (Game &game : pooled) {
+			give_input(game);
+			pool.submit([&game](){ game.update(Game::Tick); });
+		}
+		quietly([&](){ pool.wait(); });
+
+		Connection::Buffer expected = state(alone.front());
+		for (Game const &game : pooled) {
+			Connection::Buffer got = state(game);
+			if (got.size() != expected.size() || std::memcmp(got.data(), expected.data(), got.size()) != 0) {
+				differed += 1;
+				break;
+			}
+		}
+	}
+	return differed;
+}
+
+//---------------------------------------------------
+//tick rates: the same client commands (at 240Hz) and button presses (on 30Hz frame boundaries)
+// must play out exactly the same whether the server ticks at 30, 60, or 120Hz.
+//returns the number of 30Hz frames on which some game's hamsters differed from the 30Hz game's.
+
+uint32_t bench_tick_rates(uint32_t frames) {
+	const uint32_t FrameRate = 30, CommandsPerFrame = 8;
+	std::list< Game > games;
+	quietly([&](){
+		for (uint32_t rate : {30, 60, 120}) {
+			Game &game = games.emplace_back();
+			game.tick_rate = uint8_t(rate);
+			game.spawn_player();
+			game.spawn_player();
+			game.game_state = Game::GameState::InGame;
+			//(head to head, so they bump into each other and trade jabs)
+			game.players[1].position.x = game.players[0].position.x;
+		}
+	});
+
+	//the simulated part of a hamster, compared bit-for-bit:
+	auto same = [](Player const &a, Player const &b) {
+		auto eq = [](auto const &x, auto const &y) { return std::memcmp(&x, &y, sizeof(x)) == 0; };
+		return eq(a.position, b.position) && eq(a.velocity, b.velocity) && eq(a.rotation, b.rotation)
+		    && eq(a.lance_position, b.lance_position) && eq(a.lance_rotation, b.lance_rotation)
+		    && eq(a.wheel_rotation, b.wheel_rotation) && eq(a.since_attack, b.since_attack) && a.health == b.health;
+	};
+
+	uint32_t differed = 0;
+	for (uint32_t f = 0; f < frames; ++f) {
+		for (Game &game : games) {
+			uint32_t ticks = game.tick_rate / FrameRate;
+			uint32_t commands = CommandsPerFrame / ticks; //per tick
+			for (uint32_t t = 0; t < ticks; ++t) {
+				for (uint32_t i = 0; i < 2; ++i) {
+					//(both charge, jabbing every 25 frames, and now and then sweep their lances, steer, and turn)
+					Player::Controls controls;
+					controls.up.pressed = true;
+					controls.left.pressed = (f % 120 >= 100);
+					controls.jump.pressed = (f % 100 >= 80);
+					controls.mouse_x = (f % 90 >= 70 ? 0.02f : 0.0f);
+					controls.LMB.downs = (f % 25 == 3 * i ? 1 : 0);
+					if (t == 0) game.players[i].controls.add(controls);
+					for (uint32_t c = 0; c < commands; ++c) {
+						Player::Command command = controls.command(f * CommandsPerFrame + t * commands + c + 1, 1.0f / float(FrameRate * CommandsPerFrame));
+						command.mouse_x /= float(CommandsPerFrame);
+						game.queue_command(&game.players[i], command);
+					}
+				}
+				quietly([&](){ game.update(game.tick_length()); });
+			}
+		}
+		for (Game const &game : games) {
+			if (!same(game.players[0], games.front().players[0]) || !same(game.players[1], games.front().players[1])) {
+				differed += 1;
+				break;
+			}
+		}
+	}
+	return differed;
+}
+
+//---------------------------------------------------
+//recording: a scripted match recorded (as server.cpp does with --record), saved, and loaded again
+// must play back with the same result on every tick.
+//returns the number of ticks played back before the first difference (== ticks => none).
+
+uint32_t bench_recording(uint32_t ticks) {
+	Game recorded;
+	Recording recording;
+	quietly([&](){
+		recorded.spawn_player();
+		recorded.spawn_player();
+		recorded.game_state = Game::GameState::InGame;
+		recording.start(recorded);
+		for (uint32_t t = 0; t < ticks; ++t) {
+			for (uint32_t i = 0; i < 2; ++i) {
+				Player::Controls controls = scripted_controls(t, 0, i);
+				recorded.players[i].controls.add(controls);
+				recorded.queue_command(&recorded.players[i], controls.command(t + 1, Game::Tick));
+			}
+			recording.update(recorded, Game::Tick);
+		}
+	});
+
+	std::stringstream file;
+	recording.save(file);
+	Recording loaded;
+	loaded.load(file);
+
+	Game replayed;
+	uint32_t played = 0;
+	quietly([&](){ played = loaded.play(&replayed); });
+	return played;
+}
+
+int main(int argc, char **argv) {
+	if (argc > 2) {
+		std::cerr << "Usage:\n\t./bench-net [base port]" << std::endl;
+		return 1;
+	}
+	uint32_t port = (argc == 2 ? uint32_t(std::stoul(argv[1])) : 15466);
+
+	#ifdef __linux__
+	{ //thousands of connections need more file descriptors than the usual default soft limit:
+		struct rlimit limit;
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+	}
+	#endif
+
+	{ //poll backends:
+		std::cout << "Server::poll() time to deliver one message with N idle connections:" << std::endl;
+		std::cout << "  " << std::setw(8) << "N" << std::setw(14) << "select (us)" << std::setw(14) << "epoll (us)" << std::endl;
+		const uint32_t Iterations = 2000;
+		//NOTE: both ends of every connection live in this process, so select() (limited to FD_SETSIZE sockets) stops at 400:
+		for (uint32_t count : {1, 10, 100, 400, 1000, 2000, 4000, 8000}) {
+			std::cout << "  " << std::setw(8) << count;
+			if (count <= 400) {
+				double t = bench_poll(Server::Select, count, std::to_string(port++), Iterations);
+				std::cout << std::setw(14) << std::fixed << std::setprecision(2) << t * 1e6;
+			} else {
+				std::cout << std::setw(14) << "-";
+			}
+			#ifdef __linux__
+			double t = bench_poll(Server::Epoll, count, std::to_string(port++), Iterations);
+			std::cout << std::setw(14) << std::fixed << std::setprecision(2) << t * 1e6;
+			#else
+			std::cout << std::setw(14) << "-";
+			#endif
+			std::cout << std::endl;
+		}
+	}
+
+	//games shared by the benchmarks below:
+	std::unique_ptr< Game > server, client, sent;
+	quietly([&](){
+		server = std::make_unique< Game >();
+		client = std::make_unique< Game >();
+		sent = std::make_unique< Game >();
+	});
+
+	{ //state snapshot sizes:
+		for (StateFormat format : {StateFormat::Raw, StateFormat::Quantized}) {
+			Connection connection;
+			Game::StateHistory history;
+			history.format = format;
+			server->send_state_message(&connection, nullptr, &history);
+			std::cout << "Full S2C_State message, " << (format == StateFormat::Raw ? "raw" : "quantized") << ": " << connection.send_buffer.size() << " bytes" << std::endl;
+		}
+
+		std::cout << "S2C_State bytes per client per tick, full raw snapshots -> deltas in each format (ratio):" << std::endl;
+		std::cout << "  " << std::setw(10) << "format" << std::setw(10) << "ack delay";
+		for (uint32_t phase = 0; phase < PhaseCount; ++phase) {
+			std::cout << std::setw(24) << PhaseNames[phase];
+		}
+		std::cout << std::setw(24) << "whole match" << std::setw(28) << "1000 clients @30Hz (kB/s)" << std::endl;
+
+		auto row = [](size_t full, size_t delta, uint32_t ticks) {
+			std::cout << std::setw(8) << std::setprecision(1) << double(full) / ticks
+			          << " ->" << std::setw(6) << double(delta) / ticks
+			          << " (" << std::setw(4) << double(full) / double(delta) << "x)";
+		};
+
+		for (StateFormat format : {StateFormat::Raw, StateFormat::Quantized})
+		for (uint32_t ack_delay : {1, 3, 10}) {
+			StateBytes bytes = bench_state_bytes(*server, *client, *sent, format, ack_delay);
+			std::cout << "  " << std::setw(10) << (format == StateFormat::Raw ? "raw" : "quantized") << std::setw(7) << ack_delay << " tk";
+			size_t full = 0, delta = 0;
+			uint32_t ticks = 0;
+			for (uint32_t phase = 0; phase < PhaseCount; ++phase) {
+				row(bytes.full[phase], bytes.delta[phase], PhaseTicks[phase]);
+				full += bytes.full[phase];
+				delta += bytes.delta[phase];
+				ticks += PhaseTicks[phase];
+			}
+			row(full, delta, ticks);
+			std::cout << std::setw(14) << std::setprecision(0) << double(full) / ticks / Game::Tick
+			          << " ->" << std::setw(8) << double(delta) / ticks / Game::Tick << std::endl;
+		}
+	}
+
+	{ //broadcast encoding:
+		std::cout << "Server time per tick to send state to N spectators (acking every snapshot), per-connection encoding vs. StateBroadcast:" << std::endl;
+		std::cout << "  " << std::setw(10) << "format" << std::setw(8) << "N" << std::setw(22) << "per connection (us)" << std::setw(14) << "shared (us)" << std::setw(10) << "speedup" << std::endl;
+		for (StateFormat format : {StateFormat::Raw, StateFormat::Quantized})
+		for (uint32_t count : {1, 100, 10000}) {
+			BroadcastTime time = bench_broadcast(*server, *client, count, format, count >= 10000 ? 30 : 300);
+			std::cout << "  " << std::setw(10) << (format == StateFormat::Raw ? "raw" : "quantized") << std::setw(8) << count
+			          << std::setw(22) << std::fixed << std::setprecision(1) << time.per_connection * 1e6
+			          << std::setw(14) << time.shared * 1e6
+			          << std::setw(9) << std::setprecision(1) << time.per_connection / time.shared << "x" << std::endl;
+		}
+	}
+
+	{ //backed up client:
+		const uint32_t Ticks = 100000;
+		std::cout << "Server send_buffer after " << Ticks << " state messages to a client that stopped reading:" << std::endl;
+		struct { const char *name; bool replace_queued; size_t send_high_water; } configs[] = {
+			{"queue everything:", false, 0},
+			{"64k high water mark:", false, 64 * 1024},
+			{"replace queued state:", true, 0},
+		};
+		for (auto const &config : configs) {
+			BackedUp result = bench_backed_up(*server, config.replace_queued, config.send_high_water, std::to_string(port++), Ticks);
+			std::cout << "  " << std::setw(24) << config.name
+			          << std::setw(10) << result.queued << " bytes queued, " << result.dropped << " stale messages dropped" << std::endl;
+		}
+	}
+
+	{ //exchanges through simulated bad links:
+		const uint32_t Ticks = 90;
+		struct Config {
+			Transport transport;
+			char const *impairment; //(applied as each end sends)
+			uint32_t padding;
+		};
+		std::vector< Config > configs{
+			{Transport::TCP, "", 0},
+			{Transport::TCP, "send.latency=50ms,send.jitter=20ms", 0},
+			{Transport::TCP, "send.latency=50ms,send.loss=10%", 0},
+			{Transport::TCP, "send.bandwidth=64k", 1000},
+			{Transport::TCP, "send.bandwidth=16k", 1000},
+			{Transport::UDP, "", 0},
+			{Transport::UDP, "send.latency=50ms,send.jitter=20ms", 0},
+			{Transport::UDP, "send.latency=50ms,send.jitter=20ms,send.reorder=10%", 0},
+			{Transport::UDP, "send.bandwidth=64k", 1000},
+			{Transport::UDP, "send.loss=10%", 0},
+			{Transport::UDP, "send.loss=10%,send.latency=50ms", 0},
+			{Transport::UDP, "send.loss=30%", 0},
+			{Transport::UDP, "send.loss=30%,send.latency=50ms", 0},
+		};
+		std::cout << "Exchange on loopback, " << Ticks << " ticks at 30Hz through a simulated link (both directions):" << std::endl;
+		std::cout << "  " << std::left << std::setw(5) << "" << std::setw(58) << "impairment"
+		          << std::right << std::setw(18) << "reliable (srv/cli)" << std::setw(16) << "unreliable"
+		          << std::setw(14) << "delay (ms)" << std::setw(10) << "max" << std::setw(12) << "drain (s)" << std::endl;
+		for (auto const &config : configs) {
+			std::string spec = config.impairment;
+			if (config.padding) spec += " (+" + std::to_string(config.padding) + " bytes/tick)";
+			Exchange result = bench_exchange(config.transport, Impairment::parse(config.impairment), config.padding, std::to_string(port++), Ticks);
+			std::cout << "  " << std::left << std::setw(5) << (config.transport == Transport::UDP ? "udp" : "tcp") << std::setw(58) << (spec.empty() ? "(none)" : spec) << std::right
+			          << std::setw(8) << result.reliable_received[0] << "/" << result.reliable_received[1] << " of " << result.reliable_sent
+			          << std::setw(9) << result.unreliable_received << " of " << result.unreliable_sent
+			          << std::fixed << std::setprecision(1)
+			          << std::setw(10) << (result.reliable_received[1] ? 1e3 * result.delay_total / result.reliable_received[1] : 0.0)
+			          << std::setw(10) << 1e3 * result.delay_max
+			          << std::setw(12) << std::setprecision(3) << result.drain_time << std::defaultfloat << std::endl;
+			if (result.reliable_received[0] != result.reliable_sent || result.reliable_received[1] != result.reliable_sent) {
+				std::cout << "  FAILED: reliable messages lost" << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	{ //client-side prediction:
+		std::cout << "Client-side prediction error (distance between predicted and server position), 60Hz commands, 30Hz ticks:" << std::endl;
+		std::cout << "  " << std::left << std::setw(12) << "format" << std::setw(32) << "impairment" << std::right
+		          << std::setw(12) << "max" << std::setw(12) << "final" << std::setw(16) << "max replayed" << std::endl;
+		struct Config {
+			StateFormat format;
+			char const *impairment;
+		};
+		for (Config const &config : { Config{StateFormat::Raw, ""}, Config{StateFormat::Raw, "latency=50ms,jitter=10ms"},
+		                              Config{StateFormat::Quantized, ""}, Config{StateFormat::Quantized, "latency=50ms,jitter=10ms"} }) {
+			PredictionError error = bench_prediction(*server, *client, config.format, Impairment::parse(config.impairment), std::to_string(port++));
+			std::cout << "  " << std::left << std::setw(12) << (config.format == StateFormat::Raw ? "raw" : "quantized")
+			          << std::setw(32) << (config.impairment[0] ? config.impairment : "(none)") << std::right
+			          << std::setw(12) << std::setprecision(3) << std::scientific << error.max << std::setw(12) << error.final << std::defaultfloat
+			          << std::setw(16) << error.max_replayed << std::endl;
+			//with raw state and a clean link, server and client run the same float math on the same inputs:
+			if (config.format == StateFormat::Raw && !config.impairment[0] && error.final > 1e-4f) {
+				std::cout << "  FAILED: prediction did not converge to the server's position" << std::endl;
+				return 1;
+			}
+		}
+	}
+
+	{ //many matches in one server:
+		uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+		std::cout << "Server time per tick to step N matches (update + quantized state to both players), " << cores << " core(s):" << std::endl;
+		std::cout << "  " << std::setw(8) << "threads" << std::setw(8) << "N" << std::setw(14) << "tick (ms)" << std::setw(16) << "per match (us)"
+		          << std::setw(28) << "matches/core @30Hz" << std::endl;
+		std::vector< uint32_t > thread_counts{1};
+		for (uint32_t threads : {2u, 4u, cores}) {
+			if (threads <= cores && threads > thread_counts.back()) thread_counts.emplace_back(threads);
+		}
+		for (uint32_t threads : thread_counts) {
+			ThreadPool pool(threads - 1); //(plus this thread, in wait())
+			for (uint32_t count : {1, 100, 1000}) {
+				double t = bench_matches(*client, pool, count, 90);
+				std::cout << "  " << std::setw(8) << threads << std::setw(8) << count << std::setw(14) << std::fixed << std::setprecision(3) << t * 1e3
+				          << std::setw(16) << std::setprecision(2) << t / count * 1e6
+				          << std::setw(28) << std::setprecision(0) << count * (Game::Tick / t) / threads << std::defaultfloat << std::endl;
+			}
+		}
+	}
+
+	{ //determinism:
+		const uint32_t Games = 8, Ticks = 900;
+		uint32_t differed = bench_determinism(Games, Ticks);
+		std::cout << "Determinism: " << Games << " games stepped together on a ThreadPool vs. one stepped alone, same inputs for " << Ticks << " ticks: "
+		          << (differed == 0 ? "identical" : "FAILED, differed on " + std::to_string(differed) + " ticks") << std::endl;
+		if (differed != 0) return 1;
+	}
+
+	{ //tick rates:
+		const uint32_t Frames = 300;
+		uint32_t differed = bench_tick_rates(Frames);
+		std::cout << "Tick rates: 30, 60, and 120Hz games, same 240Hz commands for " << Frames << " 30Hz frames: "
+		          << (differed == 0 ? "identical" : "FAILED, differed on " + std::to_string(differed) + " frames") << std::endl;
+		if (differed != 0) return 1;
+	}
+
+	{ //recording:
+		const uint32_t Ticks = 900;
+		uint32_t played = bench_recording(Ticks);
+		std::cout << "Recording: " << Ticks << " scripted ticks saved, loaded, and played back: "
+		          << (played == Ticks ? "identical" : "FAILED, differed on tick " + std::to_string(played + 1)) << std::endl;
+		if (played != Ticks) return 1;
+	}
+
+	{ //lag compensation:
+		std::cout << "Lance hit on a hamster the attacker saw " << uint32_t(Game::InterpolationDelay / Game::Tick + 0.5f) + 1 << " ticks ago:" << std::endl;
+		bool ok = true;
+		for (float max_rewind : {0.0f, 0.05f, 0.25f}) {
+			int damage = bench_rewound_jab(*server, max_rewind);
+			bool expected = (max_rewind >= 0.25f);
+			std::cout << "  max_rewind " << std::setw(5) << std::setprecision(3) << max_rewind << "s: " << (damage > 0 ? "hit" : "miss") << " (damage " << damage << ")"
+			          << ((damage > 0) == expected ? "" : "  FAILED") << std::endl;
+			ok = ok && ((damage > 0) == expected);
+		}
+		if (!ok) return 1;
+	}
+
+	{ //quantization error:
+		RoundTripError error = bench_round_trip(*server, *client, 100000);
+		//bounds follow from the encoding: half a fixed-point step per component, 11-bit half-float mantissas, 10-bit quaternion components:
+		RoundTripError bound;
+		bound.position = 0.5f * glm::length(glm::vec3(Game::ArenaMax - Game::ArenaMin, 16.0f) / 65535.0f) * 1.01f;
+		bound.lance_position = 0.5f * glm::length(glm::vec3(16.0f) / 65535.0f) * 1.01f;
+		bound.velocity = std::sqrt(3.0f) * std::ldexp(1.0f, -11) * 1.01f;
+		bound.rotation = 0.005f;
+
+		bool ok = true;
+		std::cout << "StateFormat::Quantized round-trip error (max over random states):" << std::endl;
+		auto report = [&](const char *name, float got, float limit) {
+			std::cout << "  " << std::setw(16) << name << std::setw(14) << std::scientific << std::setprecision(3) << got << " (limit " << limit << ")" << (got <= limit ? "" : "  FAILED") << std::endl;
+			ok = ok && (got <= limit);
+		};
+		report("position", error.position, bound.position);
+		report("lance position", error.lance_position, bound.lance_position);
+		report("velocity (rel)", error.velocity, bound.velocity);
+		report("rotation (rad)", error.rotation, bound.rotation);
+		std::cout << std::defaultfloat;
+		if (!ok) return 1;
+	}
+
+	return 0;
+}
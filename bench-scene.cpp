@@ -0,0 +1,338 @@
+//bench-scene: how long it takes to find every transform's world matrix in a deep synthetic hierarchy,
+// recursing through parents (Transform::make_local_to_world) vs. with the cached matrices (Scene::update_world, Scene::world_matrix);
+// and how fast scenes copy and walk their drawables, as a Scene vs. as a Scene::Flat.
+// build with: node Maekfile.js dist/bench-scene
+// run with:   dist/bench-scene [--chains <count>] [--depth <count>] [--frames <count>]
+//
+// The scene is 'chains' separate chains of 'depth' transforms (each one parented to the one before),
+// and frames either move nothing, one transform in the middle of each chain, or every transform.
+
+#include "Scene.hpp"
+#include "data_path.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+//add 'chains' chains of 'depth' transforms (each with a drawable) to 'scene'; returns the middle transform of each chain:
+std::vector< Scene::Transform * > add_chains(Scene *scene, uint32_t chains, uint32_t depth) {
+	std::vector< Scene::Transform * > middles;
+	for (uint32_t c = 0; c < chains; ++c) {
+		Scene::Transform *parent = nullptr;
+		for (uint32_t d = 0; d < depth; ++d) {
+			scene->transforms.emplace_back();
+			Scene::Transform &transform = scene->transforms.back();
+			transform.name = "Chain" + std::to_string(c) + "." + std::to_string(d);
+			transform.position = glm::vec3(0.1f * float(c), 0.0f, 1.0f);
+			transform.rotation = glm::angleAxis(0.05f, glm::normalize(glm::vec3(1.0f, 0.5f, 0.25f)));
+			transform.scale = glm::vec3(1.01f);
+			transform.parent = parent;
+			parent = &transform;
+			if (d == depth / 2) middles.emplace_back(&transform);
+
+			//(drawables are never actually drawn; they just need to look drawable)
+			scene->drawables.emplace_back(&transform);
+			scene->drawables.back().pipeline.program = 1;
+			scene->drawables.back().pipeline.vao = 1;
+			scene->drawables.back().pipeline.count = 3;
+		}
+	}
+	return middles;
+}
+
+//is 'copy' a copy of 'scene' (same transforms, in the same order, and attachments that point into 'copy')?
+bool is_copy(Scene const &scene, Scene const &copy) {
+	scene.update_world();
+	copy.update_world();
+	if (copy.world.order.size() != scene.world.order.size() || copy.world.parents != scene.world.parents) return false;
+	for (uint32_t i = 0; i < uint32_t(scene.world.order.size()); ++i) {
+		Scene::Transform const &a = *scene.world.order[i];
+		Scene::Transform const &b = *copy.world.order[i];
+		if (&a == &b || a.name != b.name || a.position != b.position || a.rotation != b.rotation || a.scale != b.scale) return false;
+	}
+	auto same_transform = [&](Scene::Transform const *a, Scene::Transform const *b) {
+		return a->world_index == b->world_index && copy.world.order[b->world_index] == b;
+	};
+	if (copy.drawables.size() != scene.drawables.size() || copy.cameras.size() != scene.cameras.size() || copy.lights.size() != scene.lights.size()) return false;
+	for (auto const &t : scene.transforms) {
+		Scene::Transform const *found = copy.find_transform(t.name);
+		if (!found || found->name != t.name || copy.world.order[found->world_index] != found) return false;
+	}
+	for (auto a = scene.drawables.begin(), b = copy.drawables.begin(); a != scene.drawables.end(); ++a, ++b) {
+		if (!same_transform(a->transform, b->transform) || a->pipeline.count != b->pipeline.count) return false;
+	}
+	for (auto a = scene.cameras.begin(), b = copy.cameras.begin(); a != scene.cameras.end(); ++a, ++b) {
+		if (!same_transform(a->transform, b->transform) || a->fovy != b->fovy) return false;
+	}
+	for (auto a = scene.lights.begin(), b = copy.lights.begin(); a != scene.lights.end(); ++a, ++b) {
+		if (!same_transform(a->transform, b->transform) || a->energy != b->energy) return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	uint32_t chains = 64;
+	uint32_t depth = 32;
+	uint32_t frames = 200;
+	bool usage = false;
+	for (int i = 1; i < argc && !usage; ++i) {
+		std::string arg = argv[i];
+		if (i + 1 < argc && (arg == "--chains" || arg == "--depth" || arg == "--frames")) {
+			uint32_t value = uint32_t(std::stoul(argv[++i]));
+			if (value == 0) usage = true;
+			if (arg == "--chains") chains = value;
+			else if (arg == "--depth") depth = value;
+			else frames = value;
+		} else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		std::cerr << "Usage:\n\t./bench-scene [--chains <count>] [--depth <count>] [--frames <count>]" << std::endl;
+		return 1;
+	}
+
+	Scene scene;
+	std::vector< Scene::Transform * > middles = add_chains(&scene, chains, depth);
+
+	//move nothing, the middle of each chain, or everything, on frame 'f':
+	std::function< void(uint32_t) > const moves[3] = {
+		[&](uint32_t) { },
+		[&](uint32_t f) {
+			for (Scene::Transform *transform : middles) transform->position.x = 0.001f * float(f);
+		},
+		[&](uint32_t f) {
+			for (Scene::Transform &transform : scene.transforms) transform.position.x = 0.001f * float(f);
+		},
+	};
+	char const *move_names[3] = { "nothing moves", "middle of each chain moves", "everything moves" };
+
+	float sum = 0.0f; //(so the matrices can't be optimized away)
+	bool matched = true;
+	std::cout << "World matrices of " << scene.transforms.size() << " transforms (" << chains << " chains, " << depth << " deep), " << frames << " frames each:" << std::endl;
+	scene.update_world(); //(builds the cache, which isn't what's being timed)
+	for (uint32_t m = 0; m < 3; ++m) {
+		double recursive = 0.0, updated = 0.0, looked_up = 0.0;
+		uint64_t computed_before = scene.world.computed;
+		for (uint32_t f = 0; f < frames; ++f) {
+			//recursing through parents for every transform:
+			moves[m](f);
+			auto before = std::chrono::high_resolution_clock::now();
+			for (Scene::Transform const &transform : scene.transforms) {
+				sum += transform.make_local_to_world()[3].x;
+			}
+			auto after = std::chrono::high_resolution_clock::now();
+			recursive += std::chrono::duration< double >(after - before).count();
+
+			//updating the whole cache at once (as Scene::draw does):
+			moves[m](2 * f + 1);
+			before = std::chrono::high_resolution_clock::now();
+			scene.update_world();
+			for (Scene::Transform const &transform : scene.transforms) {
+				sum += scene.world.local_to_world[transform.world_index][3].x;
+			}
+			after = std::chrono::high_resolution_clock::now();
+			updated += std::chrono::duration< double >(after - before).count();
+
+			//looking up each transform (as Game does for the lance tips):
+			moves[m](2 * f + 2);
+			before = std::chrono::high_resolution_clock::now();
+			for (Scene::Transform const &transform : scene.transforms) {
+				sum += scene.world_matrix(transform)[3].x;
+			}
+			after = std::chrono::high_resolution_clock::now();
+			looked_up += std::chrono::duration< double >(after - before).count();
+
+			//cached matrices should be exactly the recursively computed ones:
+			for (Scene::Transform const &transform : scene.transforms) {
+				glm::mat4x3 expected = transform.make_local_to_world();
+				if (std::memcmp(&expected, &scene.world_matrix(transform), sizeof(expected)) != 0) matched = false;
+			}
+		}
+		//(two cached passes per frame)
+		double computed = double(scene.world.computed - computed_before) / (2.0 * frames);
+		std::cout << "  " << move_names[m] << ":" << std::fixed << std::setprecision(1)
+		          << " recursive " << recursive / frames * 1e6 << "us,"
+		          << " update_world " << updated / frames * 1e6 << "us,"
+		          << " world_matrix " << looked_up / frames * 1e6 << "us"
+		          << " per frame (" << std::setprecision(0) << computed << " matrices computed per cached pass)" << std::endl;
+	}
+	std::cout << "(checksum " << sum << ")" << std::endl;
+
+	//the cache should also notice transforms being re-parented, added, and removed:
+	for (Scene::Transform *transform : middles) {
+		transform->parent = &scene.transforms.back();
+	}
+	scene.transforms.back().parent = nullptr;
+	scene.transforms.emplace_front();
+	scene.transforms.front().parent = middles[0];
+	scene.update_world();
+	scene.transforms.pop_front();
+	scene.transforms.emplace_back();
+	scene.transforms.back().parent = &scene.transforms.front();
+	scene.transforms.back().position = glm::vec3(1.0f, 2.0f, 3.0f);
+	scene.update_world();
+	for (Scene::Transform const &transform : scene.transforms) {
+		glm::mat4x3 expected = transform.make_local_to_world();
+		if (std::memcmp(&expected, &scene.world_matrix(transform), sizeof(expected)) != 0) matched = false;
+	}
+	//..even when world_matrix() is the first to see the change:
+	middles.back()->parent = &scene.transforms.front();
+	scene.transforms.emplace_back();
+	scene.transforms.back().parent = middles.back();
+	for (Scene::Transform const &transform : scene.transforms) {
+		glm::mat4x3 expected = transform.make_local_to_world();
+		if (std::memcmp(&expected, &scene.world_matrix(transform), sizeof(expected)) != 0) matched = false;
+	}
+
+	if (!matched) {
+		std::cout << "FAILED: cached world matrices differ from Transform::make_local_to_world." << std::endl;
+		return 1;
+	}
+	std::cout << "Cached world matrices matched Transform::make_local_to_world." << std::endl;
+
+	//copying and drawing, as a Scene and as a Scene::Flat:
+	// (the synthetic scenes have a drawable per transform; arena.scene has one per mesh)
+	Scene arena(data_path("arena.scene"), [](Scene &scene, Scene::Transform *transform, std::string const &) {
+		scene.drawables.emplace_back(transform);
+	});
+	Scene wide;
+	add_chains(&wide, 1000, 10);
+	std::vector< std::pair< char const *, Scene * > > scenes{
+		{ "synthetic", &scene },
+		{ "wide synthetic", &wide },
+		{ "arena.scene", &arena },
+	};
+	bool copied = true;
+	for (auto const &[scene_name, from] : scenes) {
+		from->index_names(); //(the synthetic scenes weren't loaded, so their names aren't indexed yet)
+		Scene::Flat flat(*from);
+
+		//named lookup should find every transform where it was flattened to:
+		for (uint32_t i = 0; i < uint32_t(flat.parents.size()); ++i) {
+			if (flat.find(flat.name(i)) > i || flat.name(i) != from->world.order[i]->name) matched = false;
+		}
+		if (flat.find("not a transform name") != -1U) matched = false;
+
+		//copies into a new scene (as when a match starts), into an existing one (as when a match restarts), and of a Scene::Flat:
+		uint32_t copies = std::max(1u, 2000000u / uint32_t(from->transforms.size()));
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t c = 0; c < copies; ++c) {
+			Scene scene_copy(*from);
+			sum += float(scene_copy.transforms.size());
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		double new_copies = copies / std::chrono::duration< double >(after - before).count();
+
+		Scene scene_copy;
+		before = std::chrono::high_resolution_clock::now();
+		for (uint32_t c = 0; c < copies; ++c) {
+			scene_copy = *from;
+		}
+		after = std::chrono::high_resolution_clock::now();
+		double scene_copies = copies / std::chrono::duration< double >(after - before).count();
+
+		Scene::Flat flat_copy;
+		before = std::chrono::high_resolution_clock::now();
+		for (uint32_t c = 0; c < copies; ++c) {
+			flat_copy = flat;
+		}
+		after = std::chrono::high_resolution_clock::now();
+		double flat_copies = copies / std::chrono::duration< double >(after - before).count();
+
+		if (!is_copy(*from, scene_copy)) copied = false;
+
+		//the CPU side of drawing (moving every transform, then what draw() computes for each drawable, minus the OpenGL calls):
+		glm::mat4 world_to_clip = glm::mat4(1.0f);
+		auto uniforms = [&](glm::mat4x3 const &object_to_world) {
+			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
+			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_world)));
+			sum += object_to_clip[3].x + normal_to_light[0].x;
+		};
+		uint32_t draws = std::max(1u, 2000000u / uint32_t(from->transforms.size()));
+		before = std::chrono::high_resolution_clock::now();
+		for (uint32_t d = 0; d < draws; ++d) {
+			for (Scene::Transform &transform : scene_copy.transforms) transform.position.z = 0.001f * float(d);
+			scene_copy.update_world();
+			for (Scene::Drawable const &drawable : scene_copy.drawables) {
+				uniforms(scene_copy.world.local_to_world[drawable.transform->world_index]);
+			}
+		}
+		auto middle = std::chrono::high_resolution_clock::now();
+		for (uint32_t d = 0; d < draws; ++d) {
+			for (glm::vec3 &position : flat_copy.positions) position.z = 0.001f * float(d);
+			flat_copy.update_world();
+			for (uint32_t transform : flat_copy.drawables) {
+				uniforms(flat_copy.local_to_world[transform]);
+			}
+		}
+		after = std::chrono::high_resolution_clock::now();
+		double scene_draw = std::chrono::duration< double >(middle - before).count() / draws;
+		double flat_draw = std::chrono::duration< double >(after - middle).count() / draws;
+
+		//binding a few transforms by name, by searching the list (as Game and PlayMode used to) vs. with the name index:
+		std::vector< std::string > bind_names{
+			scene_copy.transforms.front().name,
+			scene_copy.world.order[scene_copy.transforms.size() / 2]->name,
+			scene_copy.transforms.back().name,
+		};
+		std::vector< Scene::Transform * > searched(bind_names.size(), nullptr), indexed;
+		uint32_t binds = std::max(1u, 2000000u / uint32_t(from->transforms.size()));
+		before = std::chrono::high_resolution_clock::now();
+		for (uint32_t b = 0; b < binds; ++b) {
+			std::fill(searched.begin(), searched.end(), nullptr);
+			for (auto &transform : scene_copy.transforms) {
+				for (uint32_t n = 0; n < uint32_t(bind_names.size()); ++n) {
+					if (!searched[n] && transform.name == bind_names[n]) searched[n] = &transform;
+				}
+			}
+		}
+		middle = std::chrono::high_resolution_clock::now();
+		for (uint32_t b = 0; b < binds; ++b) {
+			indexed = scene_copy.find_transforms(bind_names);
+		}
+		after = std::chrono::high_resolution_clock::now();
+		double search_bind = std::chrono::duration< double >(middle - before).count() / binds;
+		double index_bind = std::chrono::duration< double >(after - middle).count() / binds;
+		if (indexed != searched) copied = false;
+
+		//both should have ended up with the same matrices:
+		for (uint32_t i = 0; i < uint32_t(flat_copy.parents.size()); ++i) {
+			if (std::memcmp(&flat_copy.local_to_world[i], &scene_copy.world.local_to_world[i], sizeof(glm::mat4x3)) != 0) matched = false;
+		}
+
+		std::cout << scene_name << " (" << from->transforms.size() << " transforms, " << from->drawables.size() << " drawables):" << std::endl;
+		std::cout << std::fixed << std::setprecision(0)
+		          << "  copies: new Scene " << new_copies << "/second, into a Scene " << scene_copies << "/second, Scene::Flat " << flat_copies << "/second" << std::endl;
+		std::cout << std::setprecision(1)
+		          << "  move everything and walk drawables: Scene " << scene_draw * 1e6 << "us, Scene::Flat " << flat_draw * 1e6 << "us" << std::endl;
+		std::cout << std::setprecision(3)
+		          << "  find " << bind_names.size() << " transforms by name: searching " << search_bind * 1e6 << "us, find_transforms " << index_bind * 1e6 << "us" << std::endl;
+	}
+	std::cout << "(checksum " << sum << ")" << std::endl;
+
+	//copies of a scene whose world-matrix cache is out of date should come out right too:
+	Scene changed = arena;
+	changed.transforms.emplace_back();
+	changed.transforms.back().parent = &changed.transforms.front();
+	Scene changed_copy = changed;
+	if (!is_copy(changed, changed_copy)) copied = false;
+
+	if (!copied) {
+		std::cout << "FAILED: Scene copies (or name lookups in them) differ from the Scene they were copied from." << std::endl;
+		return 1;
+	}
+	std::cout << "Scene copies (and name lookups in them) matched the Scene they were copied from." << std::endl;
+
+	if (!matched) {
+		std::cout << "FAILED: Scene::Flat lookups or matrices differ from the Scene it was flattened from." << std::endl;
+		return 1;
+	}
+	std::cout << "Scene::Flat lookups and matrices matched the Scene they were flattened from." << std::endl;
+	return 0;
+}
@@ -34,13 +34,29 @@ int main(int argc, char **argv) {
 	try {
 #endif
 	//------------ command line arguments ------------
-	if (argc != 3) {
-		std::cerr << "Usage:\n\t./client <host> <port>" << std::endl;
+	Transport transport = Transport::TCP;
+	//simulated network trouble (for testing; see Impairment in Connection.hpp), from NET_IMPAIR or --impair:
+	Impairment impairment = Impairment::from_env();
+	bool usage = (argc < 3);
+	for (int i = 3; i < argc && !usage; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--udp") {
+			transport = Transport::UDP;
+		} else if (arg == "--impair" && i + 1 < argc) {
+			impairment = Impairment::parse(argv[++i]);
+		} else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		std::cerr << "Usage:\n\t./client <host> <port> [--udp] [--impair <settings>]\n"
+		             "\t(impairment settings look like 'latency=50ms,jitter=10ms,loss=2%,bandwidth=64k'; see Connection.hpp)" << std::endl;
 		return 1;
 	}
 
 	//------------ connect to server --------------
-	Client client(argv[1], argv[2]);
+	Client client(argv[1], argv[2], transport);
+	client.impairment = impairment;
 
 	//------------  initialization ------------
 
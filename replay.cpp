@@ -0,0 +1,73 @@
+//replay: re-simulate a match recorded with 'dist/server --record <path prefix>' as fast as possible,
+// checking that every tick comes out the same as it did on the server (see Recording.hpp).
+// build with: node Maekfile.js dist/replay
+// run with:   dist/replay <file.replay> [--repeat <count>]
+
+#include "Recording.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <list>
+#include <string>
+
+int main(int argc, char **argv) {
+	uint32_t repeat = 1;
+	bool usage = (argc < 2);
+	for (int i = 2; i < argc && !usage; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--repeat" && i + 1 < argc) {
+			repeat = uint32_t(std::stoul(argv[++i]));
+			if (repeat == 0) usage = true;
+		} else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		std::cerr << "Usage:\n\t./replay <file.replay> [--repeat <count>]" << std::endl;
+		return 1;
+	}
+
+	try {
+		Recording recording;
+		recording.load(argv[1]);
+		std::cout << "'" << argv[1] << "': " << recording.ticks.size() << " ticks at " << int(recording.header.tick_rate) << "Hz"
+		          << " (" << recording.commands.size() << " movement commands), starting on tick " << recording.header.first_tick << "." << std::endl;
+
+		//games are built up front, so only the simulation is timed:
+		// (and kept in a list, since games can't move)
+		std::list< Game > games;
+		for (uint32_t r = 0; r < repeat; ++r) {
+			games.emplace_back();
+		}
+
+		//(Game::update prints every hit; that's not what's being timed)
+		std::streambuf *old_out = std::cout.rdbuf(nullptr);
+		auto before = std::chrono::high_resolution_clock::now();
+		uint32_t diverged = uint32_t(recording.ticks.size());
+		for (Game &game : games) {
+			diverged = std::min(diverged, recording.play(&game));
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		std::cout.rdbuf(old_out);
+
+		if (diverged != recording.ticks.size()) {
+			std::cout << "FAILED: the replay diverged from the recording on tick " << recording.header.first_tick + diverged + 1 << "." << std::endl;
+			return 1;
+		}
+
+		std::cout << "Every tick matched the recording." << std::endl;
+		double seconds = std::chrono::duration< double >(after - before).count();
+		uint64_t ticks = uint64_t(recording.ticks.size()) * repeat;
+		if (ticks != 0) {
+			std::cout << "Simulated " << ticks << " ticks in " << std::fixed << std::setprecision(3) << seconds << "s: "
+			          << std::setprecision(0) << double(ticks) / seconds << " ticks/second (" << std::setprecision(1) << seconds / double(ticks) * 1e9 << " ns/tick)." << std::endl;
+		}
+	} catch (std::exception const &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
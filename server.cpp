@@ -1,15 +1,26 @@
 
 #include "Connection.hpp"
+#include "MessageView.hpp"
 
 #include "hex_dump.hpp"
 
 #include "Game.hpp"
+#include "ThreadPool.hpp"
+#include "SPSCQueue.hpp"
+#include "Histogram.hpp"
+#include "Recording.hpp"
 
 #include <chrono>
 #include <stdexcept>
 #include <iostream>
+#include <iomanip>
 #include <cassert>
+#include <algorithm>
 #include <unordered_map>
+#include <list>
+#include <array>
+#include <vector>
+#include <string>
 
 #ifdef _WIN32
 extern "C" { uint32_t GetACP(); }
@@ -32,47 +43,338 @@ int main(int argc, char **argv) {
 
 	//------------ argument parsing ------------
 
-	if (argc != 2) {
-		std::cerr << "Usage:\n\t./server <port>" << std::endl;
+	Transport transport = Transport::TCP;
+	//simulated network trouble (for testing; see Impairment in Connection.hpp), from NET_IMPAIR or --impair:
+	Impairment impairment = Impairment::from_env();
+	//how far back lance hits may be rewound for lag compensation (see Game::max_rewind):
+	float max_rewind = -1.0f; //(< 0 => Game's default)
+	//worker threads that step matches alongside the network thread (0 => step them on the network thread):
+	uint32_t threads = 0;
+	//updates per second:
+	uint32_t tick_rate = Game::TickRate;
+	//record each match to '<record><first tick>.replay' (empty => don't record; see Recording.hpp):
+	std::string record;
+	bool usage = (argc < 2);
+	for (int i = 2; i < argc && !usage; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--udp") {
+			transport = Transport::UDP;
+		} else if (arg == "--impair" && i + 1 < argc) {
+			impairment = Impairment::parse(argv[++i]);
+		} else if (arg == "--max-rewind" && i + 1 < argc) {
+			max_rewind = std::stof(argv[++i]);
+			if (!(max_rewind >= 0.0f)) usage = true;
+		} else if (arg == "--threads" && i + 1 < argc) {
+			threads = uint32_t(std::stoul(argv[++i]));
+		} else if (arg == "--tick-rate" && i + 1 < argc) {
+			tick_rate = uint32_t(std::stoul(argv[++i]));
+			if (tick_rate == 0 || tick_rate > 240) usage = true;
+		} else if (arg == "--record" && i + 1 < argc) {
+			record = argv[++i];
+		} else {
+			usage = true;
+		}
+	}
+	if (usage) {
+		std::cerr << "Usage:\n\t./server <port> [--udp] [--impair <settings>] [--max-rewind <seconds>] [--threads <count>] [--tick-rate <hz>] [--record <path prefix>]\n"
+		             "\t(impairment settings look like 'latency=50ms,jitter=10ms,loss=2%,bandwidth=64k'; see Connection.hpp)" << std::endl;
 		return 1;
 	}
 
 	//------------ initialization ------------
 
-	Server server(argv[1]);
+	Server server(argv[1], transport);
+	server.impairment = impairment;
+
+	//matches are stepped (and their state encoded) by this pool; see "threads" below:
+	ThreadPool pool(threads);
 
 	//------------ main loop ------------
 
-	//keep track of which connection is controlling which player:
-	std::unordered_map< Connection *, Player * > connection_to_player;
-	//keep track of game state:
-	Game game;
+	//Threads:
+	// This (network) thread does all socket i/o, matchmaking, and bookkeeping (everything below except Match::inbox consumers).
+	// Each tick it hands every match to the pool to be stepped and keeps polling while they run;
+	// controls that arrive go into the match's lock-free inbox and are applied at the start of its next step.
+	// Anything else that changes a match (players joining or leaving) waits for the start of the next tick,
+	// and once the pool is done stepping, each match's state is sent, again in parallel, while this thread waits.
+
+	//each match is an independent game, along with the connections watching (and maybe playing in) it:
+	struct Match {
+		Game game;
+		//keep track of which connection is controlling which player:
+		std::unordered_map< Connection *, Player * > connection_to_player;
+		//controls decoded by the network thread, waiting to be applied:
+		struct Input {
+			uint8_t player = 0; //index in game.players
+			uint32_t generation = 0; //generation[player] when the input arrived
+			Player::Controls controls;
+			Player::Command command;
+		};
+		SPSCQueue< Input, 256 > inbox;
+		uint32_t inbox_full = 0; //inputs dropped because the inbox was full
+		//bumped whenever a player slot changes hands, so inputs from whoever had it before are ignored:
+		std::array< uint32_t, 2 > generation = {0, 0};
+
+		//set when a step ends the post-game wait and resets the game (so players need to ready up again):
+		bool restarted = false;
+		//state messages dropped for backed-up clients by the latest broadcast:
+		uint32_t dropped = 0;
+		//when the latest step finished:
+		std::chrono::steady_clock::time_point stepped;
+
+		//everything that went into the game's updates (with --record):
+		Recording recording;
+
+		//apply queued controls (on whichever thread is stepping the match):
+		void apply_inbox() {
+			Input input;
+			while (inbox.pop(&input)) {
+				if (input.generation != generation.at(input.player)) continue;
+				Player &player = game.players.at(input.player);
+				player.controls.add(input.controls);
+				game.queue_command(&player, input.command);
+			}
+		}
+	};
+	std::list< Match > matches; //(a list, since games can't move)
+	//keep track of which match each connection is in (nullptr => not placed yet):
+	std::unordered_map< Connection *, Match * > connection_to_match;
+	//keep track of which state snapshots each connection has acknowledged:
+	std::unordered_map< Connection *, Game::StateHistory > connection_to_history;
+
+	//changes that wait for the start of the next tick:
+	std::vector< Connection * > arriving; //new connections, to be placed in a match
+	std::vector< Connection * > readying; //spectators that asked to play
+	std::vector< std::pair< Match *, Player * > > leaving; //players whose connections closed
+
+	//ticks since the server started; new matches start their own tick count here,
+	// so a connection moved between matches never sees a snapshot seq twice:
+	uint32_t tick = 0;
+	//is the pool stepping matches right now?
+	bool stepping = false;
+
+	//a match is open if it is waiting for players and has room for another one:
+	auto is_open = [](Match const &match) {
+		return match.game.game_state == Game::GameState::WaitingForPlayer && !(match.game.player_ready[0] && match.game.player_ready[1]);
+	};
+	//find an open match (or start a new one):
+	auto open_match = [&]() -> Match & {
+		for (Match &match : matches) {
+			if (is_open(match)) return match;
+		}
+		matches.emplace_back();
+		matches.back().game.tick = tick;
+		matches.back().game.tick_rate = uint8_t(tick_rate);
+		if (max_rewind >= 0.0f) matches.back().game.max_rewind = max_rewind;
+		if (!record.empty()) matches.back().recording.start(matches.back().game);
+		return matches.back();
+	};
+	//write out a match's recording so far (with --record):
+	auto save_recording = [&](Match const &match) {
+		if (record.empty()) return;
+		std::string filename = record + std::to_string(match.recording.header.first_tick) + ".replay";
+		try {
+			match.recording.save(filename);
+			std::cout << "Recorded " << match.recording.ticks.size() << " ticks to '" << filename << "'." << std::endl;
+		} catch (std::exception const &e) {
+			std::cout << "Failed to save recording: " << e.what() << std::endl;
+		}
+	};
+	//move a spectating connection to another match:
+	auto move_connection = [&](Connection *c, Match &to) {
+		Match *&from = connection_to_match.at(c);
+		if (from == &to) return;
+		assert(from->connection_to_player.at(c) == nullptr);
+		from->connection_to_player.erase(c);
+		to.connection_to_player.emplace(c, nullptr);
+		from = &to;
+		//snapshots of the old match can't be used as delta baselines:
+		Game::StateHistory &history = connection_to_history.at(c);
+		StateFormat format = history.format;
+		history = Game::StateHistory();
+		history.format = format;
+	};
+
+	//state messages dropped for backed-up clients since the last report:
+	uint32_t dropped_states = 0;
+	//controls dropped because a match's inbox was full, since the last report:
+	uint32_t dropped_inputs = 0;
+
+	//per-tick timing, since the last report:
+	struct {
+		Histogram poll; //handling incoming messages between ticks
+		Histogram update; //from the start of the tick until every match has stepped
+		Histogram send; //encoding and sending state
+		uint32_t late = 0; //ticks that started more than a tick after they were due
+		uint32_t skipped = 0; //ticks skipped because the server fell too far behind (see MaxCatchUp)
+		uint32_t overran = 0; //ticks whose update + send took longer than a tick
+	} stats;
+	double poll_seconds = 0.0; //(time spent in poll callbacks since the last tick started)
+	std::chrono::steady_clock::time_point tick_started;
+	auto seconds_since = [](std::chrono::steady_clock::time_point then) {
+		return std::chrono::duration< double >(std::chrono::steady_clock::now() - then).count();
+	};
+
+	//make the changes that waited, then hand every match to the pool to be stepped:
+	auto start_tick = [&]() {
+		assert(!stepping);
+		tick_started = std::chrono::steady_clock::now();
+		stats.poll.add(poll_seconds);
+		poll_seconds = 0.0;
+
+		for (auto const &[match, player] : leaving) {
+			match->game.remove_player(player);
+		}
+		leaving.clear();
+
+		//new connections watch a match that is waiting for players:
+		for (Connection *c : arriving) {
+			Match &match = open_match();
+			match.connection_to_player.emplace(c, nullptr);
+			connection_to_match.at(c) = &match;
+		}
+		arriving.clear();
+
+		//spectators play in their own match if it is open, or else in another one:
+		for (Connection *c : readying) {
+			if (connection_to_match.at(c)->connection_to_player.at(c) != nullptr) continue;
+			if (!is_open(*connection_to_match.at(c))) move_connection(c, open_match());
+			Match &match = *connection_to_match.at(c);
+			Player *player = match.game.spawn_player();
+			match.connection_to_player.at(c) = player;
+			if (player != nullptr) match.generation.at(size_t(player - &match.game.players[0])) += 1;
+			if (match.game.player_ready[0] && match.game.player_ready[1]) {
+				match.game.game_state = Game::GameState::InGame;
+			}
+		}
+		readying.clear();
+
+		//matches nobody is watching any more are done:
+		matches.remove_if([&](Match const &match) {
+			if (!match.connection_to_player.empty()) return false;
+			save_recording(match);
+			return true;
+		});
+
+		tick += 1;
+		for (Match &match : matches) {
+			//lag compensation: estimate which tick each player's client is drawing from the snapshots it has acknowledged:
+			for (auto const &[c, player] : match.connection_to_player) {
+				auto const &acked = connection_to_history.at(c).acked;
+				match.game.set_view(player, acked ? acked->seq : 0);
+			}
+			pool.submit([&match, recording = !record.empty()](){
+				match.apply_inbox();
+				Game::GameState before = match.game.game_state;
+				if (recording) match.recording.update(match.game, match.game.tick_length());
+				else match.game.update(match.game.tick_length());
+				match.restarted = (before == Game::GameState::Ended && match.game.game_state == Game::GameState::WaitingForPlayer);
+				match.stepped = std::chrono::steady_clock::now();
+			});
+		}
+		stepping = true;
+	};
+
+	//once the pool has stepped every match, send state:
+	auto finish_tick = [&]() {
+		assert(stepping);
+		pool.wait();
+		stepping = false;
+
+		auto stepped = tick_started;
+		for (Match &match : matches) {
+			stepped = std::max(stepped, match.stepped);
+		}
+		double update_seconds = std::chrono::duration< double >(stepped - tick_started).count();
+		stats.update.add(update_seconds);
+		auto send_started = std::chrono::steady_clock::now();
+
+		for (Match &match : matches) {
+			assert(match.game.tick == tick);
+			if (match.restarted) {
+				//everyone is a spectator again (including anyone who left in the meantime):
+				for (auto &[c, player] : match.connection_to_player) {
+					if (player != nullptr) player = nullptr;
+				}
+				leaving.erase(std::remove_if(leaving.begin(), leaving.end(), [&](auto const &left) { return left.first == &match; }), leaving.end());
+				match.restarted = false;
+				//(a game just finished, so this is a good time to save)
+				save_recording(match);
+			}
+		}
+
+		//send updated game state to all clients
+		// (encoded once per match, state format, and delta baseline, not once per client)
+		// (each match only touches its own connections' send buffers and histories)
+		for (Match &match : matches) {
+			pool.submit([&match, &connection_to_history](){
+				Game::StateBroadcast broadcast(match.game);
+				for (auto &[c, player] : match.connection_to_player) {
+					broadcast.send_state_message(c, player, &connection_to_history.at(c));
+				}
+				match.dropped = broadcast.dropped;
+			});
+		}
+		pool.wait();
+		for (Match &match : matches) {
+			dropped_states += match.dropped;
+			dropped_inputs += match.inbox_full;
+			match.inbox_full = 0;
+		}
+
+		double send_seconds = seconds_since(send_started);
+		stats.send.add(send_seconds);
+		if (update_seconds + send_seconds > 1.0 / tick_rate) stats.overran += 1;
+	};
+
+	//fixed-step scheduling: a tick is due every tick_duration, at next_tick.
+	// A server that falls behind runs the late ticks back to back to catch up, but only up to MaxCatchUp of them;
+	// past that it skips ticks (so after a long stall the game slows down rather than fast-forwarding):
+	auto const tick_duration = std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(1.0 / tick_rate));
+	constexpr uint32_t MaxCatchUp = 4;
+	auto next_tick = std::chrono::steady_clock::now() + tick_duration;
 
 	while (true) {
-		static auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(Game::Tick);
-		//process incoming data from clients until a tick has elapsed:
+		//process incoming data from clients until the next tick is due:
 		while (true) {
-			auto now = std::chrono::steady_clock::now();
-			double remain = std::chrono::duration< double >(next_tick - now).count();
-			if (remain < 0.0) {
-				next_tick += std::chrono::duration< double >(Game::Tick);
-				break;
+			double remain = std::chrono::duration< double >(next_tick - std::chrono::steady_clock::now()).count();
+			if (remain < 0.0) break;
+
+			//while the pool is stepping matches, check back often, so state goes out soon after they're done:
+			if (stepping) {
+				if (pool.idle()) {
+					finish_tick();
+					continue;
+				}
+				remain = std::min(remain, 0.001);
 			}
 
 			//helper used on client close (due to quit) and server close (due to error):
 			auto remove_connection = [&](Connection *c) {
-				auto f = connection_to_player.find(c);
-				assert(f != connection_to_player.end());
-				game.remove_player(f->second);
-				connection_to_player.erase(f);
+				auto f = connection_to_match.find(c);
+				assert(f != connection_to_match.end());
+				if (f->second == nullptr) {
+					arriving.erase(std::find(arriving.begin(), arriving.end(), c));
+				} else {
+					Match &match = *f->second;
+					Player *player = match.connection_to_player.at(c);
+					if (player != nullptr) leaving.emplace_back(&match, player);
+					match.connection_to_player.erase(c);
+				}
+				readying.erase(std::remove(readying.begin(), readying.end(), c), readying.end());
+				connection_to_match.erase(f);
+				connection_to_history.erase(c);
 			};
 
 			server.poll([&](Connection *c, Connection::Event evt){
+				auto handle_started = std::chrono::steady_clock::now();
 				if (evt == Connection::OnOpen) {
 					//client connected:
 
-					//create some player info for them:
-					connection_to_player.emplace(c, nullptr);
+					//(placed in a match at the start of the next tick)
+					connection_to_match.emplace(c, nullptr);
+					connection_to_history.emplace(c, Game::StateHistory());
+					arriving.emplace_back(c);
 
 				} else if (evt == Connection::OnClose) {
 					//client disconnected:
@@ -81,56 +383,104 @@ int main(int argc, char **argv) {
 
 				} else { assert(evt == Connection::OnRecv);
 					//got data from client:
-					//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
-
-					//look up in players list:
-					auto f = connection_to_player.find(c);
-					assert(f != connection_to_player.end());
+					//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
 
-
-					//handle messages from client:
+					//handle every complete message from client in one pass:
 					try {
-						bool handled_message;
-						do {
-							handled_message = false;
-							if (f->second == nullptr && game.game_state == Game::GameState::WaitingForPlayer) {
-								if (game.recv_handshake_message(c)) {
-									f->second = game.spawn_player();
-									if (game.player_ready[0] && game.player_ready[1]) {
-										game.game_state = Game::GameState::InGame;
-									}
-									handled_message = true;
+						dispatch_messages(c->recv_buffer, [&](MessageView const &message) {
+							//look up the connection's match and player (nullptr => spectator, or not placed yet):
+							Match *match = connection_to_match.at(c);
+							Player *player = (match ? match->connection_to_player.at(c) : nullptr);
+							if (message.type == uint8_t(Message::C2S_Handshake)) {
+								bool ready;
+								StateFormat format;
+								Game::recv_handshake_message(message, &ready, &format);
+								//switching formats means previous snapshots can't be used as delta baselines:
+								Game::StateHistory &history = connection_to_history.at(c);
+								if (history.format != format) {
+									history = Game::StateHistory();
+									history.format = format;
+								}
+								//only spectators can ready up:
+								if (ready && player == nullptr && std::find(readying.begin(), readying.end(), c) == readying.end()) {
+									readying.emplace_back(c);
 								}
-								else {
-									return; // should not accept other types of messages as spectator
+							} else if (message.type == uint8_t(Message::C2S_StateAck)) {
+								connection_to_history.at(c).recv_ack_message(message);
+							} else if (message.type == uint8_t(Message::C2S_Controls)) {
+								//spectators don't control anything:
+								if (player != nullptr) {
+									Match::Input input;
+									input.player = uint8_t(player - &match->game.players[0]);
+									input.generation = match->generation[input.player];
+									input.command = input.controls.recv_controls_message(message);
+									if (!match->inbox.push(input)) match->inbox_full += 1;
 								}
+							} else {
+								throw std::runtime_error("Unexpected message type " + std::to_string(int(message.type)) + ".");
 							}
-							Player &player = *f->second;
-							if (player.controls.recv_controls_message(c)) handled_message = true;
-							
 							//TODO: extend for more message types as needed
-						} while (handled_message);
+							return true;
+						});
 					} catch (std::exception const &e) {
 						std::cout << "Disconnecting client:" << e.what() << std::endl;
 						c->close();
 						remove_connection(c);
 					}
 				}
+				poll_seconds += seconds_since(handle_started);
 			}, remain);
 		}
 
-		//update current game state
-		Game::GameState before = game.game_state;
-		game.update(Game::Tick);
-		if (before == Game::GameState::Ended && game.game_state == Game::GameState::WaitingForPlayer) {
-			for (auto &[c, player] : connection_to_player) {
-				if (player != nullptr) player = nullptr;
+		{ //schedule the tick after this one:
+			auto now = std::chrono::steady_clock::now();
+			if (now - next_tick > tick_duration) stats.late += 1;
+			next_tick += tick_duration;
+			auto behind = (now - next_tick) / tick_duration; //(whole ticks that are already due)
+			if (behind > MaxCatchUp) {
+				stats.skipped += uint32_t(behind - MaxCatchUp);
+				next_tick += (behind - MaxCatchUp) * tick_duration;
 			}
 		}
 
-		//send updated game state to all clients
-		for (auto &[c, player] : connection_to_player) {
-			game.send_state_message(c, player);
+		//(a tick that ran long finishes now)
+		if (stepping) finish_tick();
+		start_tick();
+		//without worker threads, the matches step (on this thread) right away:
+		if (pool.worker_count() == 0) finish_tick();
+
+		//report tick timing every few seconds:
+		if (tick % (5 * tick_rate) == 0) {
+			std::cout << "Ticks at " << tick_rate << "Hz in the last 5s: " << stats.late << " late, " << stats.skipped << " skipped, " << stats.overran << " overran;"
+			          << std::fixed << std::setprecision(3);
+			auto report = [](char const *name, Histogram const &times) {
+				std::cout << " " << name << " p50/p99/max " << times.percentile(0.5) * 1e3 << "/" << times.percentile(0.99) * 1e3 << "/" << times.max * 1e3 << "ms";
+			};
+			report("poll", stats.poll);
+			report("update", stats.update);
+			report("send", stats.send);
+			std::cout << std::defaultfloat << std::endl;
+			stats.poll.clear();
+			stats.update.clear();
+			stats.send.clear();
+			stats.late = stats.skipped = stats.overran = 0;
+		}
+
+		//report clients that can't keep up every few seconds:
+		if (tick % (5 * tick_rate) == 0 && (dropped_states != 0 || dropped_inputs != 0)) {
+			uint32_t backed_up = 0;
+			size_t largest = 0;
+			for (auto const &[c, match] : connection_to_match) {
+				if (c->send_buffer.size() >= c->send_high_water) backed_up += 1;
+				largest = std::max(largest, c->send_buffer.size());
+			}
+			std::cout << "Dropped " << dropped_states << " stale state messages in the last 5s; "
+			          << backed_up << " client(s) over their send high water mark, largest send_buffer is " << largest << " bytes." << std::endl;
+			if (dropped_inputs != 0) {
+				std::cout << "Dropped " << dropped_inputs << " controls messages in the last 5s because match inboxes were full." << std::endl;
+			}
+			dropped_states = 0;
+			dropped_inputs = 0;
 		}
 
 	}